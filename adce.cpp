@@ -0,0 +1,401 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+#include "passes.h"
+#include "phaseTimer.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+// aggressive dead code elimination: everything is dead until something with a
+// side effect needs it. A conditional branch is only live if a live block is
+// control dependent on it, otherwise it becomes a jump to its post dominator.
+// Afterwards the CFG is cleaned up: unreachable blocks are deleted, blocks with
+// a single predecessor are merged into it and empty forwarding blocks removed,
+// except for loop preheaders and exit blocks.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_adce"
+STATISTIC(NumDeadInsts, "# of dead instructions deleted");
+STATISTIC(NumDeadBranches, "# of dead branches removed");
+STATISTIC(NumBlocksRemoved, "# of basic blocks merged or deleted");
+
+namespace{
+    // shared by the legacy and the new pass manager passes
+    struct bso_adce_impl{
+        DominatorTree &DT;
+        PostDominatorTree &PDT;
+        OptimizationRemarkEmitter &ORE;
+        bool is_cfg_change = false;
+
+        bso_adce_impl(DominatorTree &DT, PostDominatorTree &PDT, OptimizationRemarkEmitter &ORE)
+            : DT(DT), PDT(PDT), ORE(ORE) {};
+
+        std::set<Instruction*> live_insts;
+        std::set<BasicBlock*> live_blocks;
+        std::vector<Instruction*> worklist;
+        // rdf[B] = blocks whose terminator decides whether B runs
+        std::map<BasicBlock*, std::vector<BasicBlock*> > rdf;
+
+        void markLive(Instruction *I){
+            if (live_insts.insert(I).second) worklist.push_back(I);
+        }
+
+        // a block is live once it holds a live instruction; then the branches it
+        // is control dependent on are live as well
+        void markBlockLive(BasicBlock *BB){
+            if (!live_blocks.insert(BB).second) return;
+            for (BasicBlock *ctrl : rdf[BB]){
+                markLive(ctrl->getTerminator());
+            }
+        }
+
+        // reverse dominance frontier, computed on the post dominator tree
+        void computeControlDependence(Function &F, PostDominatorTree &PDT){
+            rdf.clear();
+            for (BasicBlock &BB : F){
+                if (BB.getTerminator()->getNumSuccessors() < 2) continue;
+                DomTreeNode *node = PDT.getNode(&BB);
+                if (node == NULL) continue;
+                DomTreeNode *ipdom = node->getIDom();
+                for (BasicBlock *succ : successors(&BB)){
+                    DomTreeNode *runner = PDT.getNode(succ);
+                    while (runner != NULL and runner != ipdom){
+                        std::vector<BasicBlock*> &ctrl = rdf[runner->getBlock()];
+                        if (ctrl.empty() or ctrl.back() != &BB) ctrl.push_back(&BB);
+                        runner = runner->getIDom();
+                    }
+                }
+            }
+        }
+
+        bool isRoot(Instruction *I, DominatorTree &DT, PostDominatorTree &PDT){
+            if (isa<DbgInfoIntrinsic>(I)) return false;
+            if (I->mayHaveSideEffects() or I->isEHPad()) return true;
+            if (!I->isTerminator()) return false;
+            BranchInst *BI = dyn_cast<BranchInst>(I);
+            if (BI == NULL) return true;            // returns, switches, unreachable...
+            if (BI->isUnconditional()) return false;
+            // keep loops: removing a loop with no live code could remove an infinite loop
+            BasicBlock *BB = BI->getParent();
+            for (BasicBlock *succ : successors(BB)){
+                if (DT.dominates(succ, BB)) return true;
+            }
+            // no post dominator to jump to instead
+            DomTreeNode *node = PDT.getNode(BB);
+            return node == NULL or node->getIDom() == NULL or node->getIDom()->getBlock() == NULL;
+        }
+
+        // replace a dead conditional branch by a jump to the post dominator; the
+        // blocks skipped this way hold nothing live
+        void removeDeadBranch(BranchInst *BI, PostDominatorTree &PDT){
+            BasicBlock *BB = BI->getParent();
+            BasicBlock *target = PDT.getNode(BB)->getIDom()->getBlock();
+            bool kept_edge = false;
+            for (BasicBlock *succ : successors(BB)){
+                if (succ == target and !kept_edge){
+                    kept_edge = true;
+                    continue;
+                }
+                // keep the phis around, the sweep deletes the dead ones
+                succ->removePredecessor(BB, true);
+            }
+            if (!kept_edge){
+                // only dead phis can be left here, give them an entry for BB
+                for (Instruction &I : *target){
+                    PHINode *PN = dyn_cast<PHINode>(&I);
+                    if (PN == NULL) break;
+                    PN->addIncoming(UndefValue::get(PN->getType()), BB);
+                }
+            }
+            BranchInst::Create(target, BI);
+            BI->eraseFromParent();
+        }
+
+        bool runADCE(Function &F){
+            std::vector<Instruction*> dead;
+            std::vector<BranchInst*> dead_branches;
+            bool isChanged = false;
+            bso_phase_timer timer("bso_adce.mark_sweep", "BSO ADCE: mark and sweep");
+
+            live_insts.clear();
+            live_blocks.clear();
+            worklist.clear();
+            computeControlDependence(F, PDT);
+
+            // mark
+            for (BasicBlock &BB : F){
+                if (!DT.isReachableFromEntry(&BB)) continue;
+                for (Instruction &I : BB){
+                    if (isRoot(&I, DT, PDT)) markLive(&I);
+                }
+            }
+            while (!worklist.empty()){
+                Instruction *I = worklist.back();
+                worklist.pop_back();
+                markBlockLive(I->getParent());
+                for (Use &U : I->operands()){
+                    if (Instruction *op = dyn_cast<Instruction>(U.get())) markLive(op);
+                }
+                // which value a phi gets depends on the edge taken into its block
+                if (PHINode *PN = dyn_cast<PHINode>(I)){
+                    for (BasicBlock *pred : PN->blocks()){
+                        markLive(pred->getTerminator());
+                    }
+                }
+            }
+
+            // sweep
+            for (BasicBlock &BB : F){
+                if (!DT.isReachableFromEntry(&BB)) continue;
+                for (Instruction &I : BB){
+                    if (live_insts.count(&I) or isa<DbgInfoIntrinsic>(I)) continue;
+                    if (I.isTerminator()){
+                        if (BranchInst *BI = dyn_cast<BranchInst>(&I)){
+                            if (BI->isConditional()) dead_branches.push_back(BI);
+                        }
+                        continue;
+                    }
+                    dead.push_back(&I);
+                }
+            }
+            // branches first, their conditions are among the dead instructions
+            for (BranchInst *BI : dead_branches){
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "DeadBranch", BI)
+                        << "branch removed: no live instruction is control dependent on it";
+                });
+                removeDeadBranch(BI, PDT);
+                ++NumDeadBranches;
+                isChanged = true;
+                is_cfg_change = true;
+            }
+            for (Instruction *I : dead){
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "DeadInstruction", I)
+                        << "removed: no side effect or live instruction depends on it";
+                });
+            }
+            for (Instruction *I : dead){
+                I->dropAllReferences();
+            }
+            for (Instruction *I : dead){
+                I->eraseFromParent();
+                ++NumDeadInsts;
+                isChanged = true;
+            }
+            return isChanged;
+        }
+
+        // ---- CFG simplification ----
+
+        bool removeUnreachableBlocks(Function &F){
+            std::set<BasicBlock*> reachable;
+            std::vector<BasicBlock*> stack;
+            std::vector<BasicBlock*> unreachable;
+            stack.push_back(&F.getEntryBlock());
+            while (!stack.empty()){
+                BasicBlock *BB = stack.back();
+                stack.pop_back();
+                if (!reachable.insert(BB).second) continue;
+                for (BasicBlock *succ : successors(BB)){
+                    stack.push_back(succ);
+                }
+            }
+            for (BasicBlock &BB : F){
+                if (reachable.count(&BB) == 0) unreachable.push_back(&BB);
+            }
+            for (BasicBlock *BB : unreachable){
+                for (BasicBlock *succ : successors(BB)){
+                    if (reachable.count(succ)) succ->removePredecessor(BB);
+                }
+                BB->dropAllReferences();
+            }
+            for (BasicBlock *BB : unreachable){
+                BB->eraseFromParent();
+                ++NumBlocksRemoved;
+            }
+            return !unreachable.empty();
+        }
+
+        // br i1 true/false, or a conditional branch with the same target twice
+        bool foldConstantBranch(BasicBlock *BB){
+            BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+            if (BI == NULL or !BI->isConditional()) return false;
+            BasicBlock *taken;
+            BasicBlock *dead;
+            if (BI->getSuccessor(0) == BI->getSuccessor(1)){
+                taken = dead = BI->getSuccessor(0);
+            }else if (ConstantInt *cond = dyn_cast<ConstantInt>(BI->getCondition())){
+                taken = BI->getSuccessor(cond->isOne() ? 0 : 1);
+                dead = BI->getSuccessor(cond->isOne() ? 1 : 0);
+            }else{
+                return false;
+            }
+            dead->removePredecessor(BB);
+            BranchInst::Create(taken, BI);
+            BI->eraseFromParent();
+            return true;
+        }
+
+        // BB has a single predecessor which has BB as its single successor
+        bool mergeIntoPredecessor(BasicBlock *BB){
+            BasicBlock *pred = BB->getSinglePredecessor();
+            if (pred == NULL or pred == BB or BB->hasAddressTaken()) return false;
+            if (pred->getTerminator()->getNumSuccessors() != 1) return false;
+            if (BB->getFirstNonPHI()->isEHPad()) return false;
+
+            // phis with a single entry are just that value
+            while (PHINode *PN = dyn_cast<PHINode>(&BB->front())){
+                PN->replaceAllUsesWith(PN->getIncomingValue(0));
+                PN->eraseFromParent();
+            }
+            // successors of BB now see pred as their predecessor
+            BB->replaceAllUsesWith(pred);
+            pred->getTerminator()->eraseFromParent();
+            pred->getInstList().splice(pred->end(), BB->getInstList());
+            BB->eraseFromParent();
+            return true;
+        }
+
+        // a block holding nothing but "br label %succ" can be bypassed when the phis
+        // in succ do not care which way control came in. Like SimplifyCFG, blocks
+        // entering a loop header or leaving a loop stay: they are the preheaders,
+        // latches and dedicated exits the loop passes would have to put back
+        bool removeForwardingBlock(BasicBlock *BB, LoopInfo &LI){
+            BasicBlock *entry = &BB->getParent()->getEntryBlock();
+            BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+            if (BB == entry or BB->hasAddressTaken() or BI == NULL or
+                BI->isConditional() or &BB->front() != BI){
+                return false;
+            }
+            BasicBlock *succ = BI->getSuccessor(0);
+            if (succ == BB) return false;
+            Loop *L = LI.getLoopFor(succ);
+            if (L != NULL and L->getHeader() == succ) return false;
+            std::vector<BasicBlock*> preds(pred_begin(BB), pred_end(BB));
+            std::set<BasicBlock*> unique_preds(preds.begin(), preds.end());
+            if (preds.empty() or unique_preds.size() != preds.size()) return false;
+            for (BasicBlock *pred : preds){
+                Loop *PL = LI.getLoopFor(pred);
+                if (PL != NULL and !PL->contains(BB)) return false;
+            }
+
+            bool has_phis = isa<PHINode>(succ->front());
+            for (BasicBlock *pred : preds){
+                for (BasicBlock *s : successors(pred)){
+                    if (s == succ and has_phis) return false;
+                }
+            }
+
+            for (Instruction &I : *succ){
+                PHINode *PN = dyn_cast<PHINode>(&I);
+                if (PN == NULL) break;
+                Value *V = PN->getIncomingValueForBlock(BB);
+                PN->removeIncomingValue(BB, false);
+                for (BasicBlock *pred : preds){
+                    PN->addIncoming(V, pred);
+                }
+            }
+            for (BasicBlock *pred : preds){
+                pred->getTerminator()->replaceUsesOfWith(BB, succ);
+            }
+            BB->eraseFromParent();
+            return true;
+        }
+
+        bool simplifyCFG(Function &F){
+            bool isChanged = false;
+            bool iterChanged = true;
+            unsigned num_blocks = F.size();
+            bso_phase_timer timer("bso_adce.simplify_cfg", "BSO ADCE: CFG simplification");
+            while (iterChanged){
+                iterChanged = removeUnreachableBlocks(F);
+                // DT is out of date once the CFG changed; a loop broken during the
+                // sweep only keeps a block until the next one
+                DominatorTree cfg_DT(F);
+                LoopInfo LI(cfg_DT);
+                for (Function::iterator b = F.begin(); b != F.end(); ){
+                    BasicBlock *BB = &(*b++);
+                    if (foldConstantBranch(BB)){
+                        iterChanged = true;
+                    }
+                    if (mergeIntoPredecessor(BB) or removeForwardingBlock(BB, LI)){
+                        ++NumBlocksRemoved;
+                        iterChanged = true;
+                    }
+                }
+                isChanged |= iterChanged;
+            }
+            if (F.size() < num_blocks){
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "CFGSimplified", F.getSubprogram(),
+                                              &F.getEntryBlock())
+                        << ore::NV("NumBlocks", num_blocks - (unsigned)F.size())
+                        << " unreachable, empty or single predecessor blocks removed";
+                });
+            }
+            return isChanged;
+        }
+
+        bool runOnFunction(Function &F){
+            // a value of a live block used only in blocks cp, jump threading or the
+            // inliner left unreachable would be deleted under that use; the trees are
+            // recomputed in place since the post dominator one holds those blocks
+            bool isChanged = false;
+            if (removeUnreachableBlocks(F)){
+                DT.recalculate(F);
+                PDT.recalculate(F);
+                isChanged = true;
+                is_cfg_change = true;
+            }
+            isChanged |= runADCE(F);
+            if (simplifyCFG(F)){
+                isChanged = true;
+                is_cfg_change = true;
+            }
+            return isChanged;
+        }
+    };
+
+    struct bso_adce : public FunctionPass{
+        static char ID;
+        bso_adce() : FunctionPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<PostDominatorTreeWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+        }
+
+        bool runOnFunction(Function &F) override{
+            bso_adce_impl impl(getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+                               getAnalysis<PostDominatorTreeWrapperPass>().getPostDomTree(),
+                               getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE());
+            return impl.runOnFunction(F);
+        }
+    };
+}
+
+PreservedAnalyses bso_adce_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_adce_impl impl(AM.getResult<DominatorTreeAnalysis>(F),
+                       AM.getResult<PostDominatorTreeAnalysis>(F),
+                       AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+    if (!impl.runOnFunction(F)) return PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    if (!impl.is_cfg_change) PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
+
+char bso_adce::ID = 0;
+static RegisterPass<bso_adce> E("bso_adce", "BSO: Aggressive Dead Code Elimination");
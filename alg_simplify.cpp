@@ -1,15 +1,43 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instruction.def"
 #include "llvm/IR/IRBuilder.h"
+#include "rangeAnalysis.h"
+#include "knownBitsAnalysis.h"
+#include "passes.h"
+#include "phaseTimer.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "bso_alg_simplify"
+STATISTIC(NumSimplified, "# of instructions simplified by algebraic identities");
+STATISTIC(NumSDivUnsigned, "# of sdivs on non-negative operands made unsigned");
+STATISTIC(NumKnownBits, "# of instructions simplified using known bits");
+
 namespace{
-    struct bso_alg_simplify : public BasicBlockPass{
-        static char ID;
-        bso_alg_simplify() : BasicBlockPass(ID){};
+    // shared by the legacy and the new pass manager passes
+    struct bso_alg_simplify_impl{
+        bso_range_info &RA;
+        bso_known_bits_info &KB;
+        OptimizationRemarkEmitter &ORE;
+
+        bso_alg_simplify_impl(bso_range_info &RA, bso_known_bits_info &KB,
+                              OptimizationRemarkEmitter &ORE) : RA(RA), KB(KB), ORE(ORE) {};
+
+        // erase I, dropping what the analyses cached about it first; rule says
+        // why it could go and ends up in the optimization remark
+        void eraseInst(Instruction *I, StringRef rule){
+            ORE.emit([&]{
+                return OptimizationRemark(DEBUG_TYPE, "Simplified", I)
+                    << ore::NV("Opcode", I->getOpcodeName()) << " simplified: " << rule;
+            });
+            RA.forgetValue(I);
+            KB.forgetValue(I);
+            I->eraseFromParent();
+        }
 
         // check whether val is a power of two
         // if not, return 0
@@ -17,7 +45,7 @@ namespace{
         int isTwoPower(int val){
             int tempval;
             int counter = 0;
-            while (val > 0){
+            while (val > 1){
                 tempval = val % 2;
                 val = val / 2;
                 if (tempval == 1){
@@ -26,16 +54,144 @@ namespace{
                     counter++;
                 }
             }
-            return counter;
+            return (val == 1) ? counter : 0;
         }
 
-        bool runOnBasicBlock(BasicBlock &BB) override{
+        // i / c = i >> log2(c), i / j = i udiv j when both sides are known to be
+        // non-negative, so the signed rounding fixups are not needed
+        bool simplifySDiv(Instruction *I){
+            Value *lhs = I->getOperand(0);
+            Value *rhs = I->getOperand(1);
+            ConstantInt *C = dyn_cast<ConstantInt>(rhs);
+            bool is_exact = cast<BinaryOperator>(I)->isExact();
+            Value *new_val;
+
+            if (!I->getType()->isIntegerTy()) return false;
+            if (C != NULL and C->isOne()) return false;     // handled as i / 1 below
+            if (!RA.isKnownNonNegative(lhs, I->getParent()) or
+                !RA.isKnownNonNegative(rhs, I->getParent())){
+                return false;
+            }
+            IRBuilder<> Builder(I);
+            if (C != NULL and C->getValue().isPowerOf2()){
+                new_val = Builder.CreateLShr(lhs, ConstantInt::get(I->getType(),
+                                             C->getValue().logBase2()), "", is_exact);
+            }else{
+                new_val = Builder.CreateUDiv(lhs, rhs, "", is_exact);
+            }
+            new_val->takeName(I);
+            I->replaceAllUsesWith(new_val);
+            eraseInst(I, C != NULL ? "non-negative division by a power of two is a shift"
+                                   : "division of non-negative values is unsigned");
+            ++NumSDivUnsigned;
+            return true;
+        }
+
+        // use bit level facts: results with every bit known become constants, masks
+        // that clear no set bit and ors that set no clear bit disappear, and
+        // extension/truncation round trips collapse
+        bool simplifyKnownBits(Instruction *I){
+            Value *new_val = NULL;
+
+            if (!I->getType()->isIntegerTy()) return false;
+            if (!isa<BinaryOperator>(I) and !isa<CastInst>(I)) return false;
+            if (!I->getOperand(0)->getType()->isIntegerTy()) return false;
+
+            known_bits res = KB.getKnownBits(I);
+            if (res.isConstant()){
+                // e.g. (x << 4) & 15 = 0
+                new_val = ConstantInt::get(I->getType(), res.one);
+            }else if (isa<BinaryOperator>(I)){
+                Value *lhs = I->getOperand(0);
+                Value *rhs = I->getOperand(1);
+                known_bits l = KB.getKnownBits(lhs);
+                known_bits r = KB.getKnownBits(rhs);
+                switch (I->getOpcode()){
+                    case Instruction::And:
+                        // every bit one side may clear is already zero in the other
+                        if ((l.zero | r.one).isAllOnesValue()){
+                            new_val = lhs;
+                        }else if ((r.zero | l.one).isAllOnesValue()){
+                            new_val = rhs;
+                        }
+                        break;
+                    case Instruction::Or:
+                        // e.g. x | 0x80 when bit 7 of x is already set
+                        if ((l.one | r.zero).isAllOnesValue()){
+                            new_val = lhs;
+                        }else if ((r.one | l.zero).isAllOnesValue()){
+                            new_val = rhs;
+                        }
+                        break;
+                    case Instruction::Xor:
+                        if (r.zero.isAllOnesValue()){
+                            new_val = lhs;
+                        }else if (l.zero.isAllOnesValue()){
+                            new_val = rhs;
+                        }
+                        break;
+                    case Instruction::Shl:
+                    case Instruction::LShr:
+                    case Instruction::AShr:
+                        if (r.zero.isAllOnesValue()) new_val = lhs;
+                        break;
+                    default:
+                        break;
+                }
+            }else{
+                Value *src = I->getOperand(0);
+                Instruction *inner = dyn_cast<Instruction>(src);
+                unsigned width = I->getType()->getIntegerBitWidth();
+                unsigned narrow = src->getType()->getIntegerBitWidth();
+                if (I->getOpcode() == Instruction::Trunc and inner != NULL and
+                    (isa<ZExtInst>(inner) or isa<SExtInst>(inner)) and
+                    inner->getOperand(0)->getType() == I->getType()){
+                    // trunc (ext x) = x
+                    new_val = inner->getOperand(0);
+                }else if ((isa<ZExtInst>(I) or isa<SExtInst>(I)) and inner != NULL and
+                          isa<TruncInst>(inner) and inner->getOperand(0)->getType() == I->getType()){
+                    // ext (trunc x) = x when the extension puts back the bits trunc dropped
+                    known_bits o = KB.getKnownBits(inner->getOperand(0));
+                    if (isa<ZExtInst>(I)){
+                        APInt high = APInt::getHighBitsSet(width, width - narrow);
+                        if ((o.zero & high) == high) new_val = inner->getOperand(0);
+                    }else{
+                        APInt high = APInt::getHighBitsSet(width, width - narrow + 1);
+                        if ((o.zero & high) == high or (o.one & high) == high){
+                            new_val = inner->getOperand(0);
+                        }
+                    }
+                }else if (isa<SExtInst>(I) and KB.getKnownBits(src).zero.isSignBitSet()){
+                    // sign bit known zero, sext is a zext
+                    IRBuilder<> Builder(I);
+                    new_val = Builder.CreateZExt(src, I->getType());
+                    new_val->takeName(I);
+                }
+            }
+
+            if (new_val == NULL) return false;
+            I->replaceAllUsesWith(new_val);
+            eraseInst(I, "the known bits of its operands decide the result");
+            ++NumKnownBits;
+            return true;
+        }
+
+        bool runOnBasicBlock(BasicBlock &BB){
             int temp;
             int constant_val;
             bool isChange = false;
+            bso_phase_timer timer("bso_alg_simplify.block", "BSO algebraic simplification");
             for (BasicBlock::iterator DI = BB.begin(); DI != BB.end(); ){
                 Instruction *I = &(*DI++);
                 ConstantInt *C1;
+                if (I->getOpcode() == Instruction::SDiv and simplifySDiv(I)){
+                    isChange = true;
+                    continue;
+                }
+                if (simplifyKnownBits(I)){
+                    isChange = true;
+                    continue;
+                }
                 if ((C1 = dyn_cast<ConstantInt>(I->getOperand(1)))){
                     temp = 1;
                 }else if ((C1 = dyn_cast<ConstantInt>(I->getOperand(0)))){
@@ -48,7 +204,8 @@ namespace{
                     if (C1->isZero()){
                         temp = (temp == 1) ? 0 : 1;     // address the non-zero operand
                         I->replaceAllUsesWith(I->getOperand(temp));
-                        I->eraseFromParent();
+                        eraseInst(I, "adding zero");
+                        ++NumSimplified;
                         isChange = true;
                     }
                 }else if (I->getOpcode() == Instruction::Sub){
@@ -57,7 +214,8 @@ namespace{
                         temp = (temp == 1) ? 0 : 1;
                         if (temp == 1){
                             I->replaceAllUsesWith(I->getOperand(temp));
-                            I->eraseFromParent();
+                            eraseInst(I, "subtracting zero");
+                            ++NumSimplified;
                             isChange = true;
                         }
                     }
@@ -65,28 +223,36 @@ namespace{
                     // 1 * i = i, i * 1 = i, i * 0 = 0, 0 * i = 0
                     if(C1->isZero()){
                         I->replaceAllUsesWith(I->getOperand(temp));
+                        eraseInst(I, "multiplying by zero");
+                        ++NumSimplified;
                         isChange = true;
                     }else if (C1->isOne()){
                         temp = (temp == 1)? 0 : 1;
                         I->replaceAllUsesWith(I->getOperand(temp));
-                        I->eraseFromParent();
+                        eraseInst(I, "multiplying by one");
+                        ++NumSimplified;
                         isChange = true;
                     }else{
                         // check whether it is a power of two
                         constant_val = isTwoPower(C1->getSExtValue());
-                        IRBuilder<> Builder(I);
-                        Value* new_val = ConstantInt::get(C1->getType(), constant_val);
-                        auto *new_inst = Builder.CreateShl(I->getOperand(0), new_val);
-                        I->replaceAllUsesWith(new_inst);
-                        I->removeFromParent();
-                        isChange = true;
+                        if (constant_val != 0){
+                            temp = (temp == 1)? 0 : 1;
+                            IRBuilder<> Builder(I);
+                            Value* new_val = ConstantInt::get(C1->getType(), constant_val);
+                            auto *new_inst = Builder.CreateShl(I->getOperand(temp), new_val);
+                            I->replaceAllUsesWith(new_inst);
+                            eraseInst(I, "multiplying by a power of two is a shift");
+                            ++NumSimplified;
+                            isChange = true;
+                        }
                     }
                 }else if (I->getOpcode() == Instruction::SDiv){
                     // i / 1 = i
                     if (temp == 1){
                         if (C1->isOne()){
                             I->replaceAllUsesWith(I->getOperand(0));
-                            I->eraseFromParent();
+                            eraseInst(I, "dividing by one");
+                            ++NumSimplified;
                             isChange = true;
                         }
                     }
@@ -96,6 +262,38 @@ namespace{
             return isChange;
         }
     };
+
+    struct bso_alg_simplify : public BasicBlockPass{
+        static char ID;
+        bso_alg_simplify() : BasicBlockPass(ID){};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequired<bso_range_wrapper>();
+            AU.addRequired<bso_known_bits_wrapper>();
+        }
+
+        bool runOnBasicBlock(BasicBlock &BB) override{
+            OptimizationRemarkEmitter ORE(BB.getParent());
+            bso_alg_simplify_impl impl(getAnalysis<bso_range_wrapper>().getInfo(),
+                                       getAnalysis<bso_known_bits_wrapper>().getInfo(), ORE);
+            return impl.runOnBasicBlock(BB);
+        }
+    };
+}
+
+PreservedAnalyses bso_alg_simplify_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_alg_simplify_impl impl(AM.getResult<bso_range_analysis>(F),
+                               AM.getResult<bso_known_bits_analysis>(F),
+                               AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+    bool isChange = false;
+    for (BasicBlock &BB : F){
+        isChange |= impl.runOnBasicBlock(BB);
+    }
+    if (!isChange) return PreservedAnalyses::all();
+    // instructions are rewritten in place, the CFG stays
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
 }
 
 char bso_alg_simplify::ID = 0;
@@ -0,0 +1,504 @@
+// Goal : Compile-time benchmark of the BSO passes. Synthetic functions of growing
+// size are generated for every pass, the pass is run through the new pass manager
+// from the plugin, and time and peak memory are reported against the input size
+// together with the growth exponent between two sizes, so quadratic and cubic
+// behaviour stands out.
+//
+//     bso_bench -plugin=lib/bso_optimization.so [-filter=bso_cse] [-steps=5]
+//
+// Every measurement runs in its own child process: its peak RSS then belongs to
+// that one pass and input alone.
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+static cl::opt<std::string> PluginPath("plugin", cl::Required,
+        cl::desc("path to bso_optimization.so"));
+static cl::opt<std::string> Filter("filter", cl::init(""),
+        cl::desc("only run the benchmarks whose pipeline contains this string"));
+static cl::opt<unsigned> Steps("steps", cl::init(5),
+        cl::desc("number of input sizes, each twice the previous one"));
+static cl::opt<unsigned> Repeat("repeat", cl::init(3),
+        cl::desc("runs per measurement, the fastest one is reported"));
+
+// ---- input generators ----
+
+// deterministic pseudo random numbers, the inputs must not change between runs
+struct lcg{
+    uint64_t state = 88172645463325252ull;
+    unsigned next(unsigned bound){
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (state >> 33) % bound;
+    }
+};
+
+// one block of n instructions: repeated expressions for cse, identities and
+// multiplications by powers of two for alg_simplify, masks for known bits and
+// values nobody uses for adce
+static void genStraightLine(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(i32, {i32, i32, i32->getPointerTo()}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_straight_line", &M);
+    IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+    auto args = F->arg_begin();
+    std::vector<Value*> pool = {&*args, &*(args + 1)};
+    Value *ptr = &*(args + 2);
+    lcg rand;
+
+    for (unsigned k = 0; k < n; k++){
+        Value *x = pool[rand.next(pool.size())];
+        Value *y = pool[rand.next(pool.size())];
+        Value *V;
+        switch (k % 8){
+            case 0: V = B.CreateAdd(x, y); break;
+            case 1: V = B.CreateMul(x, y); break;
+            case 2: V = B.CreateAdd(x, B.getInt32(0)); break;
+            case 3: V = B.CreateMul(x, B.getInt32(8)); break;
+            case 4: V = B.CreateSDiv(x, B.getInt32(1)); break;
+            case 5: V = B.CreateAnd(B.CreateShl(x, 4), B.getInt32(15)); break;
+            case 6: V = B.CreateSub(x, y); break;
+            default: V = B.CreateAdd(y, x); break;     // commuted repeat of case 0
+        }
+        pool.push_back(V);
+        if (k % 64 == 63) B.CreateStore(V, ptr);
+    }
+    B.CreateRet(pool.back());
+}
+
+// a loop around n diamonds, every diamond merging two values in a phi
+static void genReducibleCFG(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(i32, {i32, i32}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_reducible", &M);
+    Value *a = &*F->arg_begin();
+    Value *b = &*(F->arg_begin() + 1);
+    BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+    BasicBlock *header = BasicBlock::Create(C, "header", F);
+    IRBuilder<> B(entry);
+    B.CreateBr(header);
+
+    B.SetInsertPoint(header);
+    PHINode *iv = B.CreatePHI(i32, 2, "iv");
+    PHINode *acc = B.CreatePHI(i32, 2, "acc");
+    iv->addIncoming(B.getInt32(0), entry);
+    acc->addIncoming(a, entry);
+    Value *curr = acc;
+    for (unsigned k = 0; k < n; k++){
+        BasicBlock *then_bb = BasicBlock::Create(C, "then", F);
+        BasicBlock *else_bb = BasicBlock::Create(C, "else", F);
+        BasicBlock *join = BasicBlock::Create(C, "join", F);
+        B.CreateCondBr(B.CreateICmpSLT(curr, b), then_bb, else_bb);
+        B.SetInsertPoint(then_bb);
+        Value *t = B.CreateAdd(curr, B.getInt32(k));
+        B.CreateBr(join);
+        B.SetInsertPoint(else_bb);
+        Value *e = B.CreateMul(curr, b);
+        B.CreateBr(join);
+        B.SetInsertPoint(join);
+        PHINode *PN = B.CreatePHI(i32, 2);
+        PN->addIncoming(t, then_bb);
+        PN->addIncoming(e, else_bb);
+        curr = PN;
+    }
+    Value *next = B.CreateAdd(iv, B.getInt32(1));
+    BasicBlock *latch = B.GetInsertBlock();
+    BasicBlock *exit = BasicBlock::Create(C, "exit", F);
+    B.CreateCondBr(B.CreateICmpSLT(next, b), header, exit);
+    iv->addIncoming(next, latch);
+    acc->addIncoming(curr, latch);
+    B.SetInsertPoint(exit);
+    B.CreateRet(curr);
+}
+
+// n two-entry loops in a row; no block of a region dominates the other
+static void genIrreducibleCFG(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(i32, {i32, i32}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_irreducible", &M);
+    Value *a = &*F->arg_begin();
+    Value *b = &*(F->arg_begin() + 1);
+    IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+    Value *curr = a;
+    for (unsigned k = 0; k < n; k++){
+        BasicBlock *pred = B.GetInsertBlock();
+        BasicBlock *left = BasicBlock::Create(C, "left", F);
+        BasicBlock *right = BasicBlock::Create(C, "right", F);
+        BasicBlock *exit = BasicBlock::Create(C, "exit", F);
+        B.CreateCondBr(B.CreateICmpSLT(curr, b), left, right);
+
+        B.SetInsertPoint(left);
+        PHINode *l = B.CreatePHI(i32, 2);
+        Value *l_next = B.CreateAdd(l, B.getInt32(1));
+        B.CreateCondBr(B.CreateICmpSLT(l_next, b), right, exit);
+
+        B.SetInsertPoint(right);
+        PHINode *r = B.CreatePHI(i32, 2);
+        Value *r_next = B.CreateMul(r, B.getInt32(3));
+        B.CreateCondBr(B.CreateICmpSGT(r_next, b), left, exit);
+
+        l->addIncoming(curr, pred);
+        l->addIncoming(r_next, right);
+        r->addIncoming(curr, pred);
+        r->addIncoming(l_next, left);
+
+        B.SetInsertPoint(exit);
+        PHINode *PN = B.CreatePHI(i32, 2);
+        PN->addIncoming(l_next, left);
+        PN->addIncoming(r_next, right);
+        curr = PN;
+    }
+    B.CreateRet(curr);
+}
+
+// one level of a perfect nest: an invariant product for licm and an a*i+b family
+// for ido in every loop, a unit stride store in the innermost one
+static void genLoop(IRBuilder<> &B, unsigned level, unsigned depth, Value *inv, Value *ptr){
+    LLVMContext &C = B.getContext();
+    Function *F = B.GetInsertBlock()->getParent();
+    BasicBlock *pre = B.GetInsertBlock();
+    BasicBlock *header = BasicBlock::Create(C, "loop", F);
+    B.CreateBr(header);
+
+    B.SetInsertPoint(header);
+    PHINode *iv = B.CreatePHI(B.getInt32Ty(), 2, "i");
+    iv->addIncoming(B.getInt32(0), pre);
+    Value *t = B.CreateMul(inv, inv);
+    Value *j = B.CreateAdd(B.CreateMul(iv, B.getInt32(4)), t);
+    if (level + 1 < depth){
+        genLoop(B, level + 1, depth, t, ptr);
+    }else{
+        Value *addr = B.CreateGEP(ptr, j);
+        B.CreateStore(B.CreateAdd(B.CreateLoad(addr), iv), addr);
+    }
+
+    Value *next = B.CreateAdd(iv, B.getInt32(1));
+    BasicBlock *latch = B.GetInsertBlock();
+    BasicBlock *exit = BasicBlock::Create(C, "exit", F);
+    B.CreateCondBr(B.CreateICmpSLT(next, B.getInt32(16)), header, exit);
+    iv->addIncoming(next, latch);
+    B.SetInsertPoint(exit);
+}
+
+// a perfect loop nest n deep
+static void genNestedLoops(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(C), {i32, i32->getPointerTo()}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_nested_loops", &M);
+    IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+    genLoop(B, 0, n, &*F->arg_begin(), &*(F->arg_begin() + 1));
+    B.CreateRetVoid();
+}
+
+// struct initialization the way a front end emits it: every field zeroed, then
+// written again, some of them in both arms of a branch; narrow fields for merging
+static void genStructInit(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i8 = Type::getInt8Ty(C);
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(C), {i32, i8->getPointerTo()}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_struct_init", &M);
+    Value *x = &*F->arg_begin();
+    Value *ptr = &*(F->arg_begin() + 1);
+    IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+
+    for (unsigned k = 0; k < n; k++){
+        Value *field = B.CreateConstGEP1_32(ptr, k * 4);
+        Value *wide = B.CreateBitCast(field, i32->getPointerTo());
+        B.CreateStore(B.getInt32(0), wide);
+        if (k % 16 == 15){
+            BasicBlock *then_bb = BasicBlock::Create(C, "then", F);
+            BasicBlock *join = BasicBlock::Create(C, "join", F);
+            B.CreateCondBr(B.CreateICmpSLT(x, B.getInt32(k)), then_bb, join);
+            B.SetInsertPoint(then_bb);
+            B.CreateBr(join);
+            B.SetInsertPoint(join);
+        }
+        if (k % 2 == 0){
+            B.CreateStore(B.CreateAdd(x, B.getInt32(k)), wide);
+        }else{
+            for (unsigned b = 0; b < 4; b++){
+                B.CreateStore(B.getInt8(k + b), B.CreateConstGEP1_32(ptr, k * 4 + b));
+            }
+        }
+    }
+    B.CreateRetVoid();
+}
+
+// n diamonds that each set a flag the join branches on, and test again what the
+// diamond tested: the joins for jump threading to take apart
+static void genFlagChain(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i1 = Type::getInt1Ty(C);
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(i32, {i32, i32}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_flag_chain", &M);
+    Value *a = &*F->arg_begin();
+    Value *b = &*(F->arg_begin() + 1);
+    IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+    Value *curr = a;
+
+    for (unsigned k = 0; k < n; k++){
+        BasicBlock *then_bb = BasicBlock::Create(C, "then", F);
+        BasicBlock *else_bb = BasicBlock::Create(C, "else", F);
+        BasicBlock *join = BasicBlock::Create(C, "join", F);
+        BasicBlock *set = BasicBlock::Create(C, "set", F);
+        BasicBlock *next = BasicBlock::Create(C, "next", F);
+        BasicBlock *again = BasicBlock::Create(C, "again", F);
+        BasicBlock *done = BasicBlock::Create(C, "done", F);
+        Value *test = B.CreateICmpSLT(curr, b);
+        B.CreateCondBr(test, then_bb, else_bb);
+        B.SetInsertPoint(then_bb);
+        Value *t = B.CreateAdd(curr, B.getInt32(k));
+        B.CreateBr(join);
+        B.SetInsertPoint(else_bb);
+        Value *e = B.CreateMul(curr, b);
+        B.CreateBr(join);
+
+        B.SetInsertPoint(join);
+        PHINode *flag = B.CreatePHI(i1, 2, "flag");
+        flag->addIncoming(B.getTrue(), then_bb);
+        flag->addIncoming(B.getFalse(), else_bb);
+        PHINode *PN = B.CreatePHI(i32, 2);
+        PN->addIncoming(t, then_bb);
+        PN->addIncoming(e, else_bb);
+        B.CreateCondBr(flag, set, next);
+        B.SetInsertPoint(set);
+        Value *s = B.CreateXor(PN, B.getInt32(k));
+        B.CreateBr(next);
+        B.SetInsertPoint(next);
+        PHINode *merged = B.CreatePHI(i32, 2);
+        merged->addIncoming(s, set);
+        merged->addIncoming(PN, join);
+        // dominated by the diamond's own test
+        B.CreateCondBr(B.CreateICmpSLT(curr, b), again, done);
+        B.SetInsertPoint(again);
+        Value *g = B.CreateSub(merged, a);
+        B.CreateBr(done);
+        B.SetInsertPoint(done);
+        PHINode *out = B.CreatePHI(i32, 2);
+        out->addIncoming(g, again);
+        out->addIncoming(merged, next);
+        curr = out;
+    }
+    B.CreateRet(curr);
+}
+
+// n internal accessors, each a load from one field of a record, and a caller
+// that reads every field through them twice: for the inliner
+static void genAccessors(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *getter_type = FunctionType::get(i32, {i32->getPointerTo()}, false);
+    FunctionType *FT = FunctionType::get(i32, {i32->getPointerTo()}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_accessors", &M);
+    IRBuilder<> B(C);
+    std::vector<Function*> getters;
+
+    for (unsigned k = 0; k < n; k++){
+        Function *G = Function::Create(getter_type, Function::InternalLinkage, "get", &M);
+        B.SetInsertPoint(BasicBlock::Create(C, "entry", G));
+        B.CreateRet(B.CreateLoad(B.CreateConstGEP1_32(&*G->arg_begin(), k)));
+        getters.push_back(G);
+    }
+    B.SetInsertPoint(BasicBlock::Create(C, "entry", F));
+    Value *sum = B.getInt32(0);
+    for (unsigned pass = 0; pass < 2; pass++){
+        for (Function *G : getters) sum = B.CreateAdd(sum, B.CreateCall(G, {&*F->arg_begin()}));
+    }
+    B.CreateRet(sum);
+}
+
+// a recursive function, n additions long, that returns its own result plus one
+// more value: for tail recursion elimination with an accumulator
+static void genRecursive(Module &M, unsigned n){
+    LLVMContext &C = M.getContext();
+    Type *i32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(i32, {i32, i32}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bso_recursive", &M);
+    Value *depth = &*F->arg_begin();
+    Value *x = &*(F->arg_begin() + 1);
+    BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+    BasicBlock *base = BasicBlock::Create(C, "base", F);
+    BasicBlock *rec = BasicBlock::Create(C, "rec", F);
+    IRBuilder<> B(entry);
+    B.CreateCondBr(B.CreateICmpEQ(depth, B.getInt32(0)), base, rec);
+    B.SetInsertPoint(base);
+    B.CreateRet(x);
+
+    B.SetInsertPoint(rec);
+    Value *curr = x;
+    for (unsigned k = 0; k < n; k++) curr = B.CreateAdd(curr, B.CreateMul(depth, B.getInt32(k)));
+    Value *next = B.CreateCall(F, {B.CreateSub(depth, B.getInt32(1)), curr});
+    B.CreateRet(B.CreateAdd(next, curr));
+}
+
+// ---- benchmarks ----
+
+typedef void (*generator)(Module &M, unsigned n);
+
+struct benchmark{
+    const char *pipeline;
+    const char *input;
+    generator gen;
+    unsigned base_size;     // smallest input, doubled every step
+};
+
+static const benchmark Benchmarks[] = {
+    {"bso_cse", "straight-line", genStraightLine, 1000},
+    {"bso_alg_simplify", "straight-line", genStraightLine, 1000},
+    {"bso_cp", "straight-line", genStraightLine, 1000},
+    {"bso_adce", "straight-line", genStraightLine, 1000},
+    {"require<bso_known_bits_analysis>", "straight-line", genStraightLine, 1000},
+    {"require<bso_dominance_analysis>", "reducible-cfg", genReducibleCFG, 64},
+    {"require<bso_dominance_analysis>", "irreducible-cfg", genIrreducibleCFG, 64},
+    {"require<bso_liveness_analysis>", "reducible-cfg", genReducibleCFG, 64},
+    {"require<bso_liveness_analysis>", "irreducible-cfg", genIrreducibleCFG, 64},
+    {"bso_adce", "reducible-cfg", genReducibleCFG, 64},
+    {"bso_dse", "struct-init", genStructInit, 256},
+    {"bso_cp", "reducible-cfg", genReducibleCFG, 64},
+    {"bso_jump_thread", "flag-chain", genFlagChain, 64},
+    {"bso_jump_thread", "reducible-cfg", genReducibleCFG, 64},
+    {"bso_inline", "accessors", genAccessors, 256},
+    {"bso_tre", "recursive", genRecursive, 1000},
+    {"loop(bso_licm)", "nested-loops", genNestedLoops, 2},
+    {"loop(bso_ido)", "nested-loops", genNestedLoops, 2},
+    {"bso_loop_nest", "nested-loops", genNestedLoops, 2},
+    {"bso_vectorize", "nested-loops", genNestedLoops, 2},
+    {"bso-O2", "straight-line", genStraightLine, 1000},
+    {"bso-O2", "nested-loops", genNestedLoops, 2},
+};
+
+struct sample{
+    double ms;          // fastest run of the pipeline
+    long peak_kb;       // peak RSS of the whole child
+    long base_kb;       // peak RSS before the first run, i.e. the input itself
+};
+
+// build the input and run the pipeline on it; called in the child process
+static bool measure(PassPlugin &plugin, const benchmark &bm, unsigned n, sample &res){
+    res.ms = -1;
+    for (unsigned r = 0; r < Repeat; r++){
+        LLVMContext C;
+        std::unique_ptr<Module> M(new Module("bso_bench", C));
+        bm.gen(*M, n);
+        if (verifyModule(*M, &errs())) return false;
+
+        PassBuilder PB;
+        plugin.registerPassBuilderCallbacks(PB);
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+        FAM.registerPass([&]{ return PB.buildDefaultAAPipeline(); });
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        ModulePassManager MPM;
+        if (!PB.parsePassPipeline(MPM, bm.pipeline, false)) return false;
+
+        if (r == 0){
+            struct rusage ru;
+            getrusage(RUSAGE_SELF, &ru);
+            res.base_kb = ru.ru_maxrss;
+        }
+        auto start = std::chrono::steady_clock::now();
+        MPM.run(*M, MAM);
+        auto stop = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+        if (res.ms < 0 or ms < res.ms) res.ms = ms;
+    }
+    return true;
+}
+
+// fork, measure in the child, collect its peak RSS in the parent
+static bool runIsolated(PassPlugin &plugin, const benchmark &bm, unsigned n, sample &res){
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0){
+        close(fds[0]);
+        sample s;
+        bool ok = measure(plugin, bm, n, s);
+        if (ok and write(fds[1], &s, sizeof(s)) != sizeof(s)) ok = false;
+        close(fds[1]);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], &res, sizeof(res)) == sizeof(res);
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) != pid) return false;
+    if (!WIFEXITED(status) or WEXITSTATUS(status) != 0) return false;
+    res.peak_kb = ru.ru_maxrss;
+    return ok;
+}
+
+int main(int argc, char **argv){
+    cl::ParseCommandLineOptions(argc, argv, "BSO compile-time benchmarks\n");
+
+    Expected<PassPlugin> plugin = PassPlugin::Load(PluginPath);
+    if (!plugin){
+        errs() << "bso_bench: " << toString(plugin.takeError()) << "\n";
+        return 1;
+    }
+
+    outs() << "pipeline                           input                size     time(ms)"
+              "   peak(KB)   pass(KB)   growth\n";
+    bool failed = false;
+    for (const benchmark &bm : Benchmarks){
+        if (!Filter.empty() and StringRef(bm.pipeline).find(Filter) == StringRef::npos) continue;
+        sample prev;
+        unsigned prev_n = 0;
+        for (unsigned step = 0, n = bm.base_size; step < Steps; step++, n *= 2){
+            sample s;
+            if (!runIsolated(*plugin, bm, n, s)){
+                outs() << format("%-34s %-16s %8u", bm.pipeline, bm.input, n) << "       failed\n";
+                failed = true;
+                break;
+            }
+            // time ~ size^growth between this size and the previous one
+            std::string growth = "-";
+            if (prev_n != 0 and prev.ms > 0.01 and s.ms > 0.01){
+                double exp = std::log(s.ms / prev.ms) / std::log((double)n / prev_n);
+                growth = formatv("n^{0:f1}", exp);
+            }
+            outs() << format("%-34s %-16s %8u %12.3f %10ld %10ld %8s\n", bm.pipeline, bm.input, n,
+                             s.ms, s.peak_kb, s.peak_kb - s.base_kb, growth.c_str());
+            prev = s;
+            prev_n = n;
+        }
+    }
+    return failed ? 1 : 0;
+}
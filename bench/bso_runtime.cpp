@@ -0,0 +1,270 @@
+// Goal : Runtime benchmark of the code the BSO passes produce. Every kernel of the
+// corpus is optimized with each pipeline, JIT compiled with ORC and run; its time
+// is compared with the unoptimized kernel and with the LLVM -O2 pipeline, and its
+// result with the one of the unoptimized kernel. Results are written as JSON.
+//
+//     bso_runtime -plugin=lib/bso_optimization.so -o results.json kernels/*.ll
+//
+// A kernel is a module defining "i64 @bso_kernel()": it sets up its own data,
+// does the work and returns a checksum of what it computed.
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore,
+        cl::desc("<kernel .ll files>"));
+static cl::opt<std::string> PluginPath("plugin", cl::Required,
+        cl::desc("path to bso_optimization.so"));
+static cl::opt<std::string> OutputFile("o", cl::init("-"),
+        cl::desc("where to write the JSON results"));
+static cl::list<std::string> Pipelines("pipeline",
+        cl::desc("BSO pipeline to measure, may be repeated (default: every pass and bso-O2)"));
+static cl::opt<unsigned> Runs("runs", cl::init(5),
+        cl::desc("timed runs per kernel and pipeline"));
+
+static const char *DefaultPipelines[] = {
+    "bso_cse", "bso_cp", "bso_alg_simplify", "bso_adce", "bso_dse", "bso_jump_thread", "bso_tre",
+    "loop(bso_licm)", "loop(bso_ido)",
+    "bso_loop_nest", "bso_vectorize", "bso-O2", "bso_inline,function(bso-O2)",
+};
+
+// the baselines every pipeline is compared with
+static const char *Unoptimized = "O0";
+static const char *LLVMO2 = "O2";
+
+struct measurement{
+    bool ok;
+    double min_ms;
+    double median_ms;
+    uint64_t checksum;
+    char error[256];
+};
+
+static std::unique_ptr<TargetMachine> createHostTargetMachine(){
+    return std::unique_ptr<TargetMachine>(EngineBuilder().selectTarget());
+}
+
+// run the pipeline over M; O0 leaves it alone, O2 is the LLVM default pipeline
+static bool optimize(Module &M, StringRef pipeline, PassPlugin &plugin, TargetMachine *TM,
+                     std::string &error){
+    if (pipeline == Unoptimized) return true;
+    PassBuilder PB(TM);
+    plugin.registerPassBuilderCallbacks(PB);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    FAM.registerPass([&]{ return PB.buildDefaultAAPipeline(); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    if (pipeline == LLVMO2){
+        MPM = PB.buildPerModuleDefaultPipeline(PassBuilder::O2);
+    }else if (!PB.parsePassPipeline(MPM, pipeline, false)){
+        error = ("cannot parse pipeline " + pipeline).str();
+        return false;
+    }
+    MPM.run(M, MAM);
+
+    raw_string_ostream OS(error);
+    if (verifyModule(M, &OS)){
+        OS.flush();
+        error = "broken module: " + error;
+        return false;
+    }
+    return true;
+}
+
+// load, optimize, JIT and time one kernel; called in the child process
+static void measure(StringRef path, StringRef pipeline, PassPlugin &plugin, measurement &res){
+    std::string error;
+    LLVMContext C;
+    SMDiagnostic diag;
+    std::unique_ptr<Module> M = parseIRFile(path, diag, C);
+    if (!M){
+        raw_string_ostream OS(error);
+        diag.print("bso_runtime", OS);
+        OS.flush();
+        strncpy(res.error, error.c_str(), sizeof(res.error) - 1);
+        return;
+    }
+
+    std::unique_ptr<TargetMachine> TM = createHostTargetMachine();
+    M->setTargetTriple(TM->getTargetTriple().str());
+    M->setDataLayout(TM->createDataLayout());
+    if (!optimize(*M, pipeline, plugin, TM.get(), error)){
+        strncpy(res.error, error.c_str(), sizeof(res.error) - 1);
+        return;
+    }
+
+    DataLayout DL = M->getDataLayout();
+    auto J = orc::LLJIT::Create(llvm::make_unique<orc::ExecutionSession>(),
+                                createHostTargetMachine(), DL);
+    if (!J){
+        strncpy(res.error, toString(J.takeError()).c_str(), sizeof(res.error) - 1);
+        return;
+    }
+    if (Error err = (*J)->addIRModule(std::move(M))){
+        strncpy(res.error, toString(std::move(err)).c_str(), sizeof(res.error) - 1);
+        return;
+    }
+    auto sym = (*J)->lookup("bso_kernel");
+    if (!sym){
+        strncpy(res.error, toString(sym.takeError()).c_str(), sizeof(res.error) - 1);
+        return;
+    }
+    uint64_t (*kernel)() = (uint64_t (*)())(intptr_t)sym->getAddress();
+
+    // the first call pays for page faults and lazy binding
+    res.checksum = kernel();
+    std::vector<double> times;
+    for (unsigned r = 0; r < Runs; r++){
+        auto start = std::chrono::steady_clock::now();
+        uint64_t checksum = kernel();
+        auto stop = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+        if (checksum != res.checksum){
+            strncpy(res.error, "kernel returned different results between runs",
+                    sizeof(res.error) - 1);
+            return;
+        }
+    }
+    std::sort(times.begin(), times.end());
+    res.min_ms = times.front();
+    res.median_ms = times[times.size() / 2];
+    res.ok = true;
+}
+
+// a miscompiled kernel may well crash, so every measurement gets its own process
+static measurement runIsolated(StringRef path, StringRef pipeline, PassPlugin &plugin){
+    measurement res;
+    memset(&res, 0, sizeof(res));
+    int fds[2];
+    if (pipe(fds) != 0){
+        strcpy(res.error, "pipe failed");
+        return res;
+    }
+    pid_t pid = fork();
+    if (pid < 0){
+        strcpy(res.error, "fork failed");
+        return res;
+    }
+    if (pid == 0){
+        close(fds[0]);
+        measure(path, pipeline, plugin, res);
+        bool written = write(fds[1], &res, sizeof(res)) == sizeof(res);
+        close(fds[1]);
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    bool received = read(fds[0], &res, sizeof(res)) == sizeof(res);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!received){
+        memset(&res, 0, sizeof(res));
+        if (WIFSIGNALED(status)){
+            snprintf(res.error, sizeof(res.error), "crashed with signal %d", WTERMSIG(status));
+        }else{
+            strcpy(res.error, "no result from the child process");
+        }
+    }
+    return res;
+}
+
+static json::Value toJSON(StringRef pipeline, const measurement &m, const measurement &O0,
+                          const measurement &O2){
+    json::Object obj{{"pipeline", pipeline}, {"ok", m.ok}};
+    if (!m.ok){
+        obj["error"] = m.error;
+        return std::move(obj);
+    }
+    obj["min_ms"] = m.min_ms;
+    obj["median_ms"] = m.median_ms;
+    obj["checksum"] = (int64_t)m.checksum;
+    obj["matches_O0"] = O0.ok and m.checksum == O0.checksum;
+    if (O0.ok) obj["speedup_vs_O0"] = O0.min_ms / m.min_ms;
+    if (O2.ok) obj["speedup_vs_O2"] = O2.min_ms / m.min_ms;
+    return std::move(obj);
+}
+
+int main(int argc, char **argv){
+    cl::ParseCommandLineOptions(argc, argv, "BSO runtime benchmarks\n");
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    Expected<PassPlugin> plugin = PassPlugin::Load(PluginPath);
+    if (!plugin){
+        errs() << "bso_runtime: " << toString(plugin.takeError()) << "\n";
+        return 1;
+    }
+    std::vector<std::string> pipelines(Pipelines.begin(), Pipelines.end());
+    if (pipelines.empty()){
+        pipelines.assign(std::begin(DefaultPipelines), std::end(DefaultPipelines));
+    }
+
+    bool failed = false;
+    json::Array kernels;
+    for (const std::string &path : InputFiles){
+        errs() << "bso_runtime: " << path << "\n";
+        measurement O0 = runIsolated(path, Unoptimized, *plugin);
+        measurement O2 = runIsolated(path, LLVMO2, *plugin);
+        json::Array results;
+        results.push_back(toJSON(Unoptimized, O0, O0, O2));
+        results.push_back(toJSON(LLVMO2, O2, O0, O2));
+        failed |= !O0.ok or !O2.ok or O2.checksum != O0.checksum;
+        for (const std::string &pipeline : pipelines){
+            measurement m = runIsolated(path, pipeline, *plugin);
+            failed |= !m.ok or !O0.ok or m.checksum != O0.checksum;
+            results.push_back(toJSON(pipeline, m, O0, O2));
+        }
+        kernels.push_back(json::Object{{"kernel", sys::path::stem(path)},
+                                       {"runs", (int64_t)Runs},
+                                       {"results", std::move(results)}});
+    }
+
+    json::Object report{{"host", sys::getProcessTriple()},
+                        {"cpu", sys::getHostCPUName()},
+                        {"kernels", std::move(kernels)}};
+    std::error_code EC;
+    raw_fd_ostream OS(OutputFile, EC, sys::fs::F_Text);
+    if (EC){
+        errs() << "bso_runtime: " << OutputFile << ": " << EC.message() << "\n";
+        return 1;
+    }
+    OS << formatv("{0:2}", json::Value(std::move(report))) << "\n";
+    // a wrong result or a crash makes the run fail, slow code only shows in the numbers
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+; a loop over an array of points read through one-line accessors and a helper
+; called with a constant factor, the way generated code hides every field access
+; behind a call
+%struct.point = type { i64, i64 }
+
+@pts = internal global [1024 x %struct.point] zeroinitializer
+
+define internal i64 @point_x(%struct.point* %p) {
+entry:
+  %a = getelementptr %struct.point, %struct.point* %p, i32 0, i32 0
+  %v = load i64, i64* %a
+  ret i64 %v
+}
+
+define internal i64 @point_y(%struct.point* %p) {
+entry:
+  %a = getelementptr %struct.point, %struct.point* %p, i32 0, i32 1
+  %v = load i64, i64* %a
+  ret i64 %v
+}
+
+define internal void @point_set(%struct.point* %p, i64 %x, i64 %y) {
+entry:
+  %a = getelementptr %struct.point, %struct.point* %p, i32 0, i32 0
+  store i64 %x, i64* %a
+  %b = getelementptr %struct.point, %struct.point* %p, i32 0, i32 1
+  store i64 %y, i64* %b
+  ret void
+}
+
+define internal i64 @scale(i64 %v, i64 %k) {
+entry:
+  %zero = icmp eq i64 %k, 0
+  br i1 %zero, label %none, label %some
+
+none:
+  ret i64 0
+
+some:
+  %one = icmp eq i64 %k, 1
+  br i1 %one, label %same, label %mul
+
+same:
+  ret i64 %v
+
+mul:
+  %m = mul i64 %v, %k
+  ret i64 %m
+}
+
+define i64 @bso_kernel() {
+entry:
+  br label %init
+
+init:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %init ]
+  %p = getelementptr [1024 x %struct.point], [1024 x %struct.point]* @pts, i64 0, i64 %i
+  %y = mul i64 %i, 7
+  call void @point_set(%struct.point* %p, i64 %i, i64 %y)
+  %i.next = add i64 %i, 1
+  %init.done = icmp eq i64 %i.next, 1024
+  br i1 %init.done, label %outer, label %init
+
+outer:
+  %round = phi i64 [ 0, %init ], [ %round.next, %outer.latch ]
+  %sum = phi i64 [ 0, %init ], [ %sum.out, %outer.latch ]
+  br label %loop
+
+loop:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %loop ]
+  %acc = phi i64 [ %sum, %outer ], [ %acc.next, %loop ]
+  %q = getelementptr [1024 x %struct.point], [1024 x %struct.point]* @pts, i64 0, i64 %j
+  %x = call i64 @point_x(%struct.point* %q)
+  %yy = call i64 @point_y(%struct.point* %q)
+  %sx = call i64 @scale(i64 %x, i64 3)
+  %sy = call i64 @scale(i64 %yy, i64 1)
+  %t = add i64 %sx, %sy
+  %acc.next = add i64 %acc, %t
+  %j.next = add i64 %j, 1
+  %loop.done = icmp eq i64 %j.next, 1024
+  br i1 %loop.done, label %outer.latch, label %loop
+
+outer.latch:
+  %sum.out = phi i64 [ %acc.next, %loop ]
+  %round.next = add i64 %round, 1
+  %outer.done = icmp eq i64 %round.next, 20000
+  br i1 %outer.done, label %exit, label %outer
+
+exit:
+  ret i64 %sum.out
+}
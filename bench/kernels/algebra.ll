@@ -0,0 +1,36 @@
+; arithmetic the front end would leave behind without optimization: identities,
+; multiplications and divisions by powers of two, masks and repeated expressions
+@seed = internal global i32 7
+
+define i64 @bso_kernel() {
+entry:
+  %s = load volatile i32, i32* @seed
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %x = add i32 %i, %s
+  %x0 = add i32 %x, 0
+  %x1 = mul i32 %x0, 1
+  %x8 = mul i32 %x1, 8
+  %d1 = sdiv i32 %x8, 1
+  %lo = and i32 %x, 1023
+  %q = sdiv i32 %lo, 4
+  %e1 = mul i32 %x, %s
+  %e2 = mul i32 %s, %x
+  %sum = add i32 %e1, %e2
+  %hi = shl i32 %lo, 12
+  %mask = and i32 %hi, 4095
+  %t0 = add i32 %d1, %q
+  %t1 = add i32 %t0, %sum
+  %t2 = or i32 %t1, %mask
+  %t64 = zext i32 %t2 to i64
+  %acc.next = add i64 %acc, %t64
+  %i.next = add i32 %i, 1
+  %cond = icmp ult i32 %i.next, 50000000
+  br i1 %cond, label %loop, label %done
+
+done:
+  ret i64 %acc.next
+}
@@ -0,0 +1,26 @@
+; a loop recomputing the same products of a value it cannot see through on every
+; iteration, and using a*i+b forms of its counter
+@seed = internal global i32 1000
+
+define i64 @bso_kernel() {
+entry:
+  %n = load volatile i32, i32* @seed
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %sq = mul i32 %n, %n
+  %sq3 = add i32 %sq, 3
+  %lin = mul i32 %i, 12
+  %aff = add i32 %lin, %sq3
+  %mix = xor i32 %aff, %i
+  %mix64 = zext i32 %mix to i64
+  %acc.next = add i64 %acc, %mix64
+  %i.next = add i32 %i, 1
+  %cond = icmp ult i32 %i.next, 50000000
+  br i1 %cond, label %loop, label %done
+
+done:
+  ret i64 %acc.next
+}
@@ -0,0 +1,77 @@
+; c = a * b for 128x128 matrices stored row major, in the i-j-k order that walks
+; b by column; the checksum is the sum of c
+@a = internal global [16384 x i32] zeroinitializer
+@b = internal global [16384 x i32] zeroinitializer
+@c = internal global [16384 x i32] zeroinitializer
+
+define i64 @bso_kernel() {
+entry:
+  br label %init
+
+init:
+  %n = phi i64 [ 0, %entry ], [ %n.next, %init ]
+  %ap = getelementptr [16384 x i32], [16384 x i32]* @a, i64 0, i64 %n
+  %bp = getelementptr [16384 x i32], [16384 x i32]* @b, i64 0, i64 %n
+  %cp = getelementptr [16384 x i32], [16384 x i32]* @c, i64 0, i64 %n
+  %n32 = trunc i64 %n to i32
+  %av = and i32 %n32, 255
+  store i32 %av, i32* %ap
+  %bv = urem i32 %n32, 13
+  store i32 %bv, i32* %bp
+  store i32 0, i32* %cp
+  %n.next = add i64 %n, 1
+  %init.cond = icmp ult i64 %n.next, 16384
+  br i1 %init.cond, label %init, label %i.loop
+
+i.loop:
+  %i = phi i64 [ 0, %init ], [ %i.next, %i.latch ]
+  br label %j.loop
+
+j.loop:
+  %j = phi i64 [ 0, %i.loop ], [ %j.next, %j.latch ]
+  br label %k.loop
+
+k.loop:
+  %k = phi i64 [ 0, %j.loop ], [ %k.next, %k.loop ]
+  %i.row = mul i64 %i, 128
+  %a.idx = add i64 %i.row, %k
+  %k.row = mul i64 %k, 128
+  %b.idx = add i64 %k.row, %j
+  %c.idx = add i64 %i.row, %j
+  %a.ptr = getelementptr [16384 x i32], [16384 x i32]* @a, i64 0, i64 %a.idx
+  %b.ptr = getelementptr [16384 x i32], [16384 x i32]* @b, i64 0, i64 %b.idx
+  %c.ptr = getelementptr [16384 x i32], [16384 x i32]* @c, i64 0, i64 %c.idx
+  %a.val = load i32, i32* %a.ptr
+  %b.val = load i32, i32* %b.ptr
+  %c.val = load i32, i32* %c.ptr
+  %prod = mul i32 %a.val, %b.val
+  %c.new = add i32 %c.val, %prod
+  store i32 %c.new, i32* %c.ptr
+  %k.next = add i64 %k, 1
+  %k.cond = icmp ult i64 %k.next, 128
+  br i1 %k.cond, label %k.loop, label %j.latch
+
+j.latch:
+  %j.next = add i64 %j, 1
+  %j.cond = icmp ult i64 %j.next, 128
+  br i1 %j.cond, label %j.loop, label %i.latch
+
+i.latch:
+  %i.next = add i64 %i, 1
+  %i.cond = icmp ult i64 %i.next, 128
+  br i1 %i.cond, label %i.loop, label %sum
+
+sum:
+  %s = phi i64 [ 0, %i.latch ], [ %s.next, %sum ]
+  %acc = phi i64 [ 0, %i.latch ], [ %acc.next, %sum ]
+  %sp = getelementptr [16384 x i32], [16384 x i32]* @c, i64 0, i64 %s
+  %v = load i32, i32* %sp
+  %v64 = zext i32 %v to i64
+  %acc.next = add i64 %acc, %v64
+  %s.next = add i64 %s, 1
+  %sum.cond = icmp ult i64 %s.next, 16384
+  br i1 %sum.cond, label %sum, label %done
+
+done:
+  ret i64 %acc.next
+}
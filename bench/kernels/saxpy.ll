@@ -0,0 +1,57 @@
+; y = 3*x + y over 64K elements, 64 times; the checksum is the sum of y
+@x = internal global [65536 x i32] zeroinitializer
+@y = internal global [65536 x i32] zeroinitializer
+
+define i64 @bso_kernel() {
+entry:
+  br label %init
+
+init:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %init ]
+  %xp = getelementptr [65536 x i32], [65536 x i32]* @x, i64 0, i64 %i
+  %yp = getelementptr [65536 x i32], [65536 x i32]* @y, i64 0, i64 %i
+  %i32 = trunc i64 %i to i32
+  %xv = mul i32 %i32, 7
+  store i32 %xv, i32* %xp
+  %yv = xor i32 %i32, 12345
+  store i32 %yv, i32* %yp
+  %i.next = add i64 %i, 1
+  %init.cond = icmp ult i64 %i.next, 65536
+  br i1 %init.cond, label %init, label %rep
+
+rep:
+  %r = phi i64 [ 0, %init ], [ %r.next, %rep.latch ]
+  br label %loop
+
+loop:
+  %j = phi i64 [ 0, %rep ], [ %j.next, %loop ]
+  %xp2 = getelementptr [65536 x i32], [65536 x i32]* @x, i64 0, i64 %j
+  %yp2 = getelementptr [65536 x i32], [65536 x i32]* @y, i64 0, i64 %j
+  %a = load i32, i32* %xp2
+  %b = load i32, i32* %yp2
+  %m = mul i32 %a, 3
+  %s = add i32 %m, %b
+  store i32 %s, i32* %yp2
+  %j.next = add i64 %j, 1
+  %loop.cond = icmp ult i64 %j.next, 65536
+  br i1 %loop.cond, label %loop, label %rep.latch
+
+rep.latch:
+  %r.next = add i64 %r, 1
+  %rep.cond = icmp ult i64 %r.next, 64
+  br i1 %rep.cond, label %rep, label %sum
+
+sum:
+  %k = phi i64 [ 0, %rep.latch ], [ %k.next, %sum ]
+  %acc = phi i64 [ 0, %rep.latch ], [ %acc.next, %sum ]
+  %yp3 = getelementptr [65536 x i32], [65536 x i32]* @y, i64 0, i64 %k
+  %v = load i32, i32* %yp3
+  %v64 = zext i32 %v to i64
+  %acc.next = add i64 %acc, %v64
+  %k.next = add i64 %k, 1
+  %sum.cond = icmp ult i64 %k.next, 65536
+  br i1 %sum.cond, label %sum, label %done
+
+done:
+  ret i64 %acc.next
+}
@@ -0,0 +1,87 @@
+; a record built in a loop the way a front end initializes it: zeroed field by
+; field, then written again, its byte flags one at a time. A table filled in a
+; loop and its last element written again after it ends the checksum
+%struct.rec = type { i32, i32, i8, i8, i8, i8, i64 }
+
+@seed = internal global i32 3
+@tbl = internal global [64 x i32] zeroinitializer
+
+define i64 @bso_kernel() {
+entry:
+  %s = load volatile i32, i32* @seed
+  %r = alloca %struct.rec
+  %f0 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 0
+  %f1 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 1
+  %f2 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 2
+  %f3 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 3
+  %f4 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 4
+  %f5 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 5
+  %f6 = getelementptr %struct.rec, %struct.rec* %r, i32 0, i32 6
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %next ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %next ]
+  store volatile i32 0, i32* %f0
+  store i32 0, i32* %f1
+  store i8 0, i8* %f2
+  store i8 0, i8* %f3
+  store i8 0, i8* %f4
+  store i8 0, i8* %f5
+  store i64 0, i64* %f6
+  %x = add i32 %i, %s
+  store volatile i32 %x, i32* %f0
+  %odd = and i32 %i, 1
+  %is_odd = icmp ne i32 %odd, 0
+  br i1 %is_odd, label %odd_bb, label %even_bb
+
+odd_bb:
+  store i32 1, i32* %f1
+  br label %next
+
+even_bb:
+  store i32 2, i32* %f1
+  br label %next
+
+next:
+  store i8 1, i8* %f2
+  store i8 2, i8* %f3
+  store i8 3, i8* %f4
+  store i8 4, i8* %f5
+  %x64 = zext i32 %x to i64
+  store i64 %x64, i64* %f6
+  %v0 = load volatile i32, i32* %f0
+  %v1 = load i32, i32* %f1
+  %p = bitcast i8* %f2 to i32*
+  %v2 = load i32, i32* %p
+  %v6 = load i64, i64* %f6
+  %a = add i32 %v0, %v1
+  %b = xor i32 %a, %v2
+  %b64 = zext i32 %b to i64
+  %c = add i64 %b64, %v6
+  %acc.next = add i64 %acc, %c
+  %i.next = add i32 %i, 1
+  %cond = icmp ult i32 %i.next, 50000000
+  br i1 %cond, label %loop, label %done
+
+done:
+  br label %fill
+
+; only the last element is written again, the others keep what the loop stored
+fill:
+  %k = phi i64 [ 0, %done ], [ %k.next, %fill ]
+  %e = getelementptr [64 x i32], [64 x i32]* @tbl, i64 0, i64 %k
+  %k32 = trunc i64 %k to i32
+  store i32 %k32, i32* %e
+  %k.next = add i64 %k, 1
+  %fill.cond = icmp ult i64 %k.next, 64
+  br i1 %fill.cond, label %fill, label %filled
+
+filled:
+  store i32 1000, i32* %e
+  %t.ptr = getelementptr [64 x i32], [64 x i32]* @tbl, i64 0, i64 5
+  %t = load i32, i32* %t.ptr
+  %t64 = zext i32 %t to i64
+  %res = add i64 %acc.next, %t64
+  ret i64 %res
+}
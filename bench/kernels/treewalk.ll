@@ -0,0 +1,70 @@
+; recursive helpers over a complete binary tree kept in an array: a walk down
+; the right spine written as tail recursion, and a depth sum written as
+; return v + f(...), which needs an accumulator to become a loop
+@tree = internal global [4096 x i64] zeroinitializer
+
+; the rightmost leaf below node i, one level at a time
+define internal i64 @rightmost(i64 %i) {
+entry:
+  %r = mul i64 %i, 2
+  %right = add i64 %r, 2
+  %leaf = icmp uge i64 %right, 4095
+  br i1 %leaf, label %done, label %down
+
+done:
+  ret i64 %i
+
+down:
+  %next = call i64 @rightmost(i64 %right)
+  ret i64 %next
+}
+
+; the values on the path from node i up to the root
+define internal i64 @path_sum(i64 %i) {
+entry:
+  %p = getelementptr [4096 x i64], [4096 x i64]* @tree, i64 0, i64 %i
+  %v = load i64, i64* %p
+  %root = icmp eq i64 %i, 0
+  br i1 %root, label %done, label %up
+
+done:
+  ret i64 %v
+
+up:
+  %i1 = sub i64 %i, 1
+  %parent = lshr i64 %i1, 1
+  %rest = call i64 @path_sum(i64 %parent)
+  %sum = add i64 %v, %rest
+  ret i64 %sum
+}
+
+define i64 @bso_kernel() {
+entry:
+  br label %init
+
+init:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %init ]
+  %p = getelementptr [4096 x i64], [4096 x i64]* @tree, i64 0, i64 %i
+  %v = mul i64 %i, 2654435761
+  %vv = lshr i64 %v, 7
+  store i64 %vv, i64* %p
+  %i.next = add i64 %i, 1
+  %init.done = icmp eq i64 %i.next, 4095
+  br i1 %init.done, label %loop, label %init
+
+loop:
+  %j = phi i64 [ 0, %init ], [ %j.next, %loop ]
+  %acc = phi i64 [ 0, %init ], [ %acc.next, %loop ]
+  %node = urem i64 %j, 2047
+  %leaf = call i64 @rightmost(i64 %node)
+  %s = call i64 @path_sum(i64 %leaf)
+  %s2 = call i64 @path_sum(i64 %node)
+  %t = xor i64 %s, %s2
+  %acc.next = add i64 %acc, %t
+  %j.next = add i64 %j, 1
+  %loop.done = icmp eq i64 %j.next, 2000000
+  br i1 %loop.done, label %exit, label %loop
+
+exit:
+  ret i64 %acc.next
+}
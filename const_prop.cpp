@@ -1,27 +1,58 @@
 #include "llvm/Pass.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.def"
+#include "llvm/IR/Instructions.h"
+#include "rangeAnalysis.h"
+#include "passes.h"
+#include "phaseTimer.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "bso_cp"
 STATISTIC(NumXForms, "# of instructions deleted");
+STATISTIC(NumCmpFolded, "# of compares folded using value ranges");
+STATISTIC(NumBranchFolded, "# of conditional branches made unconditional");
 
 namespace{
-    struct bso_cp : public FunctionPass{
-        static char ID;
-        bso_cp() : FunctionPass(ID) {};
+    // shared by the legacy and the new pass manager passes
+    struct bso_cp_impl{
+        bso_range_info &RA;
+        OptimizationRemarkEmitter &ORE;
+        bool is_cfg_change = false;     // some branch lost an edge
 
-        bool runOnFunction(Function &F) override{
+        bso_cp_impl(bso_range_info &RA, OptimizationRemarkEmitter &ORE) : RA(RA), ORE(ORE) {};
+
+        // a branch on a constant only ever takes one edge, drop the other one
+        bool foldBranch(BasicBlock *BB){
+            BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+            if (BI == NULL or !BI->isConditional()) return false;
+            ConstantInt *cond = dyn_cast<ConstantInt>(BI->getCondition());
+            if (cond == NULL) return false;
+            BasicBlock *taken = BI->getSuccessor(cond->isOne() ? 0 : 1);
+            BasicBlock *dead = BI->getSuccessor(cond->isOne() ? 1 : 0);
+            ORE.emit([&]{
+                return OptimizationRemark(DEBUG_TYPE, "BranchFolded", BI)
+                    << "branch on a constant condition, the edge to "
+                    << ore::NV("Dead", dead) << " is never taken";
+            });
+            dead->removePredecessor(BB);
+            BranchInst::Create(taken, BI);
+            BI->eraseFromParent();
+            return true;
+        }
+
+        bool runOnFunction(Function &F){
             ConstantInt* CI1, *CI2;
             Value * newVal;
             int op1, op2, fin_val, opcode;
             bool is_change;
 
             is_change = false;
+            bso_phase_timer timer("bso_cp.fold", "BSO CP: fold constants and compares");
             // for every basic block in Function
             for (Function::iterator b = F.begin(); b != F.end(); ){
                 // for every instruction in basic block
@@ -37,6 +68,15 @@ namespace{
                             op1 = CI1->getSExtValue();
                             op2 = CI2->getSExtValue();
                             opcode = I->getOpcode();
+                            if ((opcode == Instruction::SDiv or opcode == Instruction::SRem) and
+                                    op2 == 0){
+                                // undefined behaviour, leave it for the program to trap on
+                                ORE.emit([&]{
+                                    return OptimizationRemarkMissed(DEBUG_TYPE, "DivisionByZero", I)
+                                        << "not folded: the divisor is the constant zero";
+                                });
+                                continue;
+                            }
                             if (opcode == Instruction::Mul){
                                 fin_val = op1 * op2;    
                             }else if (opcode == Instruction::Add){
@@ -51,19 +91,77 @@ namespace{
                                 continue;
                             }
                             newVal = ConstantInt::get(CI1->getType(), fin_val);
+                            ORE.emit([&]{
+                                return OptimizationRemark(DEBUG_TYPE, "ConstantFolded", I)
+                                    << "both operands are constants, folded to "
+                                    << ore::NV("Value", fin_val);
+                            });
                             // replae all uses with the new constant
                             I->replaceAllUsesWith(newVal);
                             // remove that instruction
+                            RA.forgetValue(I);
                             I->eraseFromParent();
                             ++NumXForms;
                             is_change = true;
                         }
+                    }else if (auto* cmp = dyn_cast<ICmpInst>(I)){
+                        // if the value ranges of the operands decide the compare,
+                        // e.g. a bounds check the loop condition already implies
+                        Optional<bool> outcome = RA.evaluateCompare(cmp);
+                        if (outcome.hasValue()){
+                            newVal = ConstantInt::get(I->getType(), outcome.getValue());
+                            ORE.emit([&]{
+                                return OptimizationRemark(DEBUG_TYPE, "CompareFolded", I)
+                                    << "the value ranges of the operands decide the compare, "
+                                    << "folded to " << (outcome.getValue() ? "true" : "false");
+                            });
+                            I->replaceAllUsesWith(newVal);
+                            RA.forgetValue(I);
+                            I->eraseFromParent();
+                            ++NumCmpFolded;
+                            is_change = true;
+                        }
                     }
                 }
             }
+
+            // branches whose compare got folded above
+            bso_phase_timer branch_timer("bso_cp.branches", "BSO CP: fold branches");
+            for (BasicBlock &BB : F){
+                if (foldBranch(&BB)){
+                    ++NumBranchFolded;
+                    is_change = true;
+                    is_cfg_change = true;
+                }
+            }
             return is_change;
         }
     };
+
+    struct bso_cp : public FunctionPass{
+        static char ID;
+        bso_cp() : FunctionPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequired<bso_range_wrapper>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+        }
+
+        bool runOnFunction(Function &F) override{
+            return bso_cp_impl(getAnalysis<bso_range_wrapper>().getInfo(),
+                               getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE())
+                .runOnFunction(F);
+        }
+    };
+}
+
+PreservedAnalyses bso_cp_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_cp_impl impl(AM.getResult<bso_range_analysis>(F),
+                     AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+    if (!impl.runOnFunction(F)) return PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    if (!impl.is_cfg_change) PA.preserveSet<CFGAnalyses>();
+    return PA;
 }
 
 char bso_cp::ID = 0;
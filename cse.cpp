@@ -1,7 +1,12 @@
 #include"llvm/ADT/Statistic.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Pass.h"
+#include "passes.h"
+#include "phaseTimer.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
@@ -10,11 +15,14 @@ using namespace llvm;
 STATISTIC(NumXForms, "# of instructions deleted");
 
 namespace{
-struct bso_cse : public BasicBlockPass{
-    
-    static char ID;
-    bso_cse() : BasicBlockPass(ID) {};
-    
+// shared by the legacy and the new pass manager passes
+struct bso_cse_impl{
+    OptimizationRemarkEmitter &ORE;
+    // the AEB chain of the current block lives here, reset for every block
+    BumpPtrAllocator arena;
+
+    bso_cse_impl(OptimizationRemarkEmitter &ORE) : ORE(ORE) {};
+
     // A building block for available instructions
     struct AEB{
         int pos;
@@ -35,28 +43,28 @@ struct bso_cse : public BasicBlockPass{
         return false;
     }
     
-    // print AEB out for debugging purposes
+    // print AEB out for debugging purposes (-debug-only=bso_cse)
     void printAEB(AEB* head){
         
         AEB* curr;
         
         curr = head;
         while(curr != NULL){
-            errs() << "Counter: " << curr->pos << "\n";
-            errs() << "opcode: " << curr->opcode << "\n";   
-            errs() << "op1: " << curr->op1->getName() << "\n";
-            errs() << "op2: " << curr->op2->getName() <<  "\n";
-            errs() << "tmp: " << curr->tmp->getName() << "\n";
-            errs() << "--------------------------------------\n";
+            dbgs() << "Counter: " << curr->pos << "\n";
+            dbgs() << "opcode: " << curr->opcode << "\n";   
+            dbgs() << "op1: " << curr->op1->getName() << "\n";
+            dbgs() << "op2: " << curr->op2->getName() <<  "\n";
+            dbgs() << "tmp: " << curr->tmp->getName() << "\n";
+            dbgs() << "--------------------------------------\n";
             curr = curr->next;
         }
     }
 
-    bool runOnBasicBlock(BasicBlock &BB) override{
-        // errs() <<  "In Basic Block!\n"; 
+    bool runOnBasicBlock(BasicBlock &BB){
+        bso_phase_timer timer("bso_cse.block", "BSO CSE: available expressions");
         int counter;
         bool no_match, is_change;
-        AEB *head, *curr, *temp, *match_aeb;
+        AEB *head, *tail, *curr, *temp, *match_aeb;
 
         int opcode;
         Value *lhs, *rhs, *tmp_val;
@@ -65,6 +73,8 @@ struct bso_cse : public BasicBlockPass{
         no_match = true;
         is_change = false;
         head = NULL;
+        tail = NULL;
+        arena.Reset();
 
         // for every instruction in basic block
         for (BasicBlock::iterator DI = BB.begin(); DI != BB.end(); ){
@@ -96,28 +106,32 @@ struct bso_cse : public BasicBlockPass{
                     curr = curr->next;
                 }
 
+                tmp_val = dyn_cast<Value>(I);
                 // if noMatch is true
                 if (no_match){
                     // insert another AEB
-                    temp = new AEB;
+                    temp = new (arena.Allocate<AEB>()) AEB;
                     temp->pos = counter;
                     temp->opcode = opcode;
                     temp->op1 = lhs;
                     temp->op2 = rhs;
-                    temp->tmp = dyn_cast<Value>(I);
+                    temp->tmp = tmp_val;
                     temp->next = NULL;
-                    curr = head;
                     if (head == NULL){
                         head = temp;
                     }else{
-                        while (curr->next != NULL){
-                            curr = curr->next;
-                        }
-                        curr->next = temp;
+                        tail->next = temp;
                     }
+                    tail = temp;
                 }else{
                     // if noMatch is false
                     // replace all uses with the temp value in AEB
+                    ORE.emit([&]{
+                        return OptimizationRemark(DEBUG_TYPE, "Eliminated", I)
+                            << "replaced by the earlier "
+                            << ore::NV("Available", match_aeb->tmp)
+                            << " computing the same expression";
+                    });
                     I->replaceAllUsesWith(match_aeb->tmp);  // HAVE TO CHECK THIS!
                     // remove the instruction
                     I->eraseFromParent();
@@ -125,35 +139,55 @@ struct bso_cse : public BasicBlockPass{
                     is_change = true;
                 }
 
-                curr = head;
-                tmp_val = dyn_cast<Value>(I);
                 // go through AEB with the assigned value
-                while(curr != NULL){
+                AEB **link = &head;
+                tail = NULL;
+                while(*link != NULL){
+                    curr = *link;
                     // if operand 1 or operand 2 is the same value as the assigne value, 
-                    // remove that specific expression
+                    // remove that specific expression; the arena takes it back with the block
                     if (curr->op1 == tmp_val or curr->op2 == tmp_val){
-                        temp = curr->next;
-                        curr = temp->next;
-                        free(temp);
+                        *link = curr->next;
+                    }else{
+                        tail = curr;
+                        link = &curr->next;
                     }
-                    curr = curr->next;
                 }
 
             }
             counter ++;
         }
-        // printAEB(head);
+        LLVM_DEBUG(printAEB(head));
         
         return is_change;
     }
 
 };
 
-    
+struct bso_cse : public BasicBlockPass{
+    static char ID;
+    bso_cse() : BasicBlockPass(ID) {};
 
-}
+    bool runOnBasicBlock(BasicBlock &BB) override{
+        OptimizationRemarkEmitter ORE(BB.getParent());
+        return bso_cse_impl(ORE).runOnBasicBlock(BB);
+    }
+};
 
+}
 
+PreservedAnalyses bso_cse_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_cse_impl impl(AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+    bool is_change = false;
+    for (BasicBlock &BB : F){
+        is_change |= impl.runOnBasicBlock(BB);
+    }
+    if (!is_change) return PreservedAnalyses::all();
+    // only instructions inside a block go away
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
 
 char bso_cse::ID = 0;
 static RegisterPass<bso_cse> X("bso_cse", "BSO : Common Subexpression Elimination");
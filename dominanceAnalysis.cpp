@@ -3,226 +3,262 @@
 // Goal : Perform dominance analysis on each basic block, printing out, for each BB :
 // dominators, immediate dominator, inverse dominators, and strict dominators
 
-#include "llvm/Pass.h"
+#include "dominanceAnalysis.h"
+#include "phaseTimer.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/CFG.h"
-#include <vector>
-#include <map>
 
 using namespace llvm;
 
-namespace{
-    struct bso_dominance_analysis : public FunctionPass{
-        static char ID;
-        bso_dominance_analysis() : FunctionPass(ID) {};
-        
-        struct bb_info{
-            BasicBlock* BB;
-            std::vector<bool> dominators;
-            std::vector<bool> strict_dominators;
-            std::vector<bool> immediate_dominators;
-            std::vector<bool> inverse_dominators; 
-        };
-
-        std::map<BasicBlock*, int> value_mapper;    // maps BB to location on bit vector
-        std::map<BasicBlock*, bb_info*> bb_info_mapper;
-        
-        // utility to check whether two boolean vectors are equal
-        bool isEqual(std::vector<bool> a, std::vector<bool> b){
-            if (a.size() != b.size()) return false;
-            for (unsigned i = 0 ; i < a.size(); i++){
-                if (a[i] != b[i]) return false;
-            }
-            return true;
-        }
+#define DEBUG_TYPE "bso_dominance_analysis"
+STATISTIC(NumFunctions, "# of functions analyzed");
+STATISTIC(NumSweeps, "# of sweeps over the CFG until the dominator sets settled");
 
-        
-        // utility to implement meet operation in dominance analysis, which is 
-        // intersection of dominator list
-        std::vector<bool> meet(std::vector<BasicBlock*> bb_list){
-            std::vector<bool> ret;
-            if (bb_list.size() == 0) return ret;
-            for (unsigned i = 0; i <  bb_list.size(); i++){
-                if (i == 0){
-                    ret = bb_info_mapper[bb_list[i]]->dominators;
-                }else{
-                    for (unsigned j = 0 ; j < bb_info_mapper[bb_list[i]]->dominators.size(); j++){
-                        if (!(ret[j] == true and bb_info_mapper[bb_list[i]]->dominators[j] == true)){
-                            ret[j] = false;
-                        }
-                    }
+void bso_dominance_info::reset(){
+    value_mapper.clear();
+    blocks.clear();
+}
+
+bool bso_dominance_info::invalidate(Function &F, const PreservedAnalyses &PA,
+                                    FunctionAnalysisManager::Invalidator &Inv){
+    auto PAC = PA.getChecker<bso_dominance_analysis>();
+    return !(PAC.preserved() or PAC.preservedSet<AllAnalysesOn<Function> >() or
+             PAC.preservedSet<CFGAnalyses>());
+}
+
+// utility to check whether two boolean vectors are equal
+bool bso_dominance_info::isEqual(const std::vector<bool> &a, const std::vector<bool> &b){
+    if (a.size() != b.size()) return false;
+    for (unsigned i = 0 ; i < a.size(); i++){
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// utility to implement meet operation in dominance analysis, which is 
+// intersection of dominator list
+std::vector<bool> bso_dominance_info::meet(const std::vector<BasicBlock*> &bb_list){
+    std::vector<bool> ret;
+    if (bb_list.size() == 0) return ret;
+    for (unsigned i = 0; i <  bb_list.size(); i++){
+        if (i == 0){
+            ret = info(bb_list[i]).dominators;
+        }else{
+            for (unsigned j = 0 ; j < info(bb_list[i]).dominators.size(); j++){
+                if (!(ret[j] == true and info(bb_list[i]).dominators[j] == true)){
+                    ret[j] = false;
                 }
             }
-            return ret;
         }
+    }
+    return ret;
+}
 
-        // utility to perform union between Basic block and the dominator list
-        std::vector<bool> un(BasicBlock* BB, std::vector<bool> p_list){
-            p_list[value_mapper[BB]] = true;
-            return p_list;
+// utility to perform union between Basic block and the dominator list
+std::vector<bool> bso_dominance_info::un(BasicBlock* BB, std::vector<bool> p_list){
+    p_list[value_mapper[BB]] = true;
+    return p_list;
+}
+
+void bso_dominance_info::printBitVector(raw_ostream &O, const std::vector<bool> &b){
+    for (unsigned i = 0 ; i < b.size(); i++){
+        if (b[i] == false){
+            O << "0";
+        }else{
+            O << "1";
         }
+    }
 
-        void printBitVector(std::vector<bool> b){
-            for (unsigned i = 0 ; i < b.size(); i++){
-                if (b[i] == false){
-                    errs() << "0";
-                }else{
-                    errs() << "1";
-                }
-            }
+}
 
-        }
+void bso_dominance_info::printResult(raw_ostream &O, BasicBlock* BB){
+    O << "BasicBlock : " << BB->getName() << "\n";
+    O << "Dominators: ";
+    printBitVector(O, info(BB).dominators);
+    O << "\n";
+    O <<  "Strict Dominators: ";
+    printBitVector(O, info(BB).strict_dominators);
+    O << "\n";
+    O <<  "Inverse Dominators: ";
+    printBitVector(O, info(BB).inverse_dominators);
+    O << "\n";
+    O <<  "Immediate Dominators: ";
+    printBitVector(O, info(BB).immediate_dominators);
+    O << "\n";
+
+}
+
+void bso_dominance_info::compute(Function &F){
+
+    unsigned counter;
+    bool isChanged, isImmDom;
+    std::vector<bool> new_dom;
+    std::vector<BasicBlock*> p_list;
+    std::vector<bool> p_i;  // boolean to keep track of intersection of predecessors
+    counter = 0;
+    isChanged = true;
+    ++NumFunctions;
 
-        void printResult(BasicBlock* BB){
-            errs() << "BasicBlock : " << BB->getName() << "\n";
-            errs() << "Dominators: ";
-            printBitVector(bb_info_mapper[BB]->dominators);
-            errs() << "\n";
-            errs() <<  "Strict Dominators: ";
-            printBitVector(bb_info_mapper[BB]->strict_dominators);
-            errs() << "\n";
-            errs() <<  "Inverse Dominators: ";
-            printBitVector(bb_info_mapper[BB]->inverse_dominators);
-            errs() << "\n";
-            errs() <<  "Immediate Dominators: ";
-            printBitVector(bb_info_mapper[BB]->immediate_dominators);
-            errs() << "\n";
+    bso_phase_timer timer("bso_dominance.dominators", "BSO dominance: dominator sets");
+    // setup value_mapper, blocks are numbered in function order
+    reset();
+    value_mapper.reserve(F.size());
+    blocks.resize(F.size());
+    for (Function::iterator b = F.begin(); b != F.end(); b++){
+        BasicBlock* BB = &(*b);
+        value_mapper[BB] = counter;
+        blocks[counter].BB = BB;
+        counter++;
+    }
 
+    // initialize the dominator set 
+    for (Function::iterator b = F.begin(); b != F.end(); b++){
+        BasicBlock *BB = &(*b);
+        // set dom(BB) = whole set of basic blocks
+        for (unsigned i = 0 ; i< counter; i++){
+            info(BB).dominators.push_back(true);
+            info(BB).inverse_dominators.push_back(false);
+            info(BB).immediate_dominators.push_back(false);
         }
-        
-        bool runOnFunction(Function &F) override{
-
-            unsigned counter;
-            bool isChanged, isImmDom;
-            std::vector<bool> new_dom;
-            std::vector<BasicBlock*> p_list;
-            std::vector<bool> p_i;  // boolean to keep track of intersection of predecessors
-            counter = 0;
-            isChanged = true;
-
-            // setup value_mapper
-            for (Function::iterator b = F.begin(); b != F.end(); b++){
-                BasicBlock* BB = &(*b);
-
-                if (value_mapper.find(BB) == value_mapper.end()){
-                    value_mapper[BB] = counter;
-                    bb_info_mapper[BB] = new bb_info;
-                    counter++;
+        if (BB == &(F.getEntryBlock())){
+            // set dom(entry) = entry only
+            for (unsigned i = 0  ; i < counter; i++){
+                if (i != value_mapper[BB]){
+                    info(BB).dominators[i] = false;
                 }
-                
             }
+        }
+    }
 
-            // initialize the dominator set 
-            for (Function::iterator b = F.begin(); b != F.end(); b++){
-                BasicBlock *BB = &(*b);
-                // set dom(BB) = whole set of basic blocks
-                for (unsigned i = 0 ; i< counter; i++){
-                    bb_info_mapper[BB]->dominators.push_back(true);
-                    bb_info_mapper[BB]->inverse_dominators.push_back(false);
-                    bb_info_mapper[BB]->immediate_dominators.push_back(false);
+    // go through the algorithm for finding dominators
+    while (isChanged){
+        isChanged = false;
+        ++NumSweeps;
+        for (Function::iterator b = F.begin(); b != F.end(); b++){
+            BasicBlock *BB = &(*b);
+            // for every block except the entry block
+            if (BB != &(F.getEntryBlock())){
+                info(BB).dominators;
+                // find the intersection of BB of dominators of predecessors
+                p_list.clear();
+                for (BasicBlock* predecessor : predecessors(BB)){
+                    p_list.push_back(predecessor);
                 }
-                if (BB == &(F.getEntryBlock())){
-                    // set dom(entry) = entry only
-                    for (unsigned i = 0  ; i < counter; i++){
-                        if (i != value_mapper[BB]){
-                            bb_info_mapper[BB]->dominators[i] = false;
-                        }
-                    }
+                p_i = meet(p_list);
+                new_dom = un(BB, p_i);
+                if (!isEqual(new_dom, info(BB).dominators)){
+                    info(BB).dominators = new_dom;
+                    isChanged = true;
                 }
             }
+        }
+    }
 
-            // go through the algorithm for finding dominators
-            while (isChanged){
-                isChanged = false;
-                for (Function::iterator b = F.begin(); b != F.end(); b++){
-                    BasicBlock *BB = &(*b);
-                    // for every block except the entry block
-                    if (BB != &(F.getEntryBlock())){
-                        bb_info_mapper[BB]->dominators;
-                        // find the intersection of BB of dominators of predecessors
-                        p_list.clear();
-                        for (BasicBlock* predecessor : predecessors(BB)){
-                            p_list.push_back(predecessor);
-                        }
-                        p_i = meet(p_list);
-                        new_dom = un(BB, p_i);
-                        if (!isEqual(new_dom, bb_info_mapper[BB]->dominators)){
-                            bb_info_mapper[BB]->dominators = new_dom;
-                            isChanged = true;
-                        }
-                    }
-                }
-            }
+    // find strict dominators
+    bso_phase_timer derived_timer("bso_dominance.derived",
+                                  "BSO dominance: strict, immediate and inverse dominators");
+    for (Function::iterator b = F.begin(); b != F.end(); b++){
+        BasicBlock *BB = &(*b);
+        info(BB).strict_dominators = info(BB).dominators;
+        info(BB).strict_dominators[value_mapper[BB]] = false;
+    }
 
-            // find strict dominators
-            for (Function::iterator b = F.begin(); b != F.end(); b++){
-                BasicBlock *BB = &(*b);
-                bb_info_mapper[BB]->strict_dominators = bb_info_mapper[BB]->dominators;
-                bb_info_mapper[BB]->strict_dominators[value_mapper[BB]] = false;
+    // find immediate dominators
+    // the definition of immediate dominators is that it is the closest dominator to d
+    // meaning that other dominators that dominate d also dominate the immediate dominator
+    // it is proven that every block has a unique immediate dominator
+    for (Function::iterator b = F.begin(); b !=  F.end(); b ++){
+        BasicBlock *BB = &(*b);
+        // loop through strict dominators
+        if (BB != &(F.getEntryBlock())){
+            p_list.clear();     // use this list to save dominators
+            
+            for (Function::iterator b2 =F.begin(); b2 != F.end(); b2++){
+                BasicBlock *BB2 = &(*b2);
+                if (info(BB).strict_dominators[value_mapper[BB2]] == true){
+                    p_list.push_back(BB2);
+                }
             }
-
-            // find immediate dominators
-            // the definition of immediate dominators is that it is the closest dominator to d
-            // meaning that other dominators that dominate d also dominate the immediate dominator
-            // it is proven that every block has a unique immediate dominator
-            for (Function::iterator b = F.begin(); b !=  F.end(); b ++){
-                BasicBlock *BB = &(*b);
-                // loop through strict dominators
-                if (BB != &(F.getEntryBlock())){
-                    p_list.clear();     // use this list to save dominators
-                    
-                    for (Function::iterator b2 =F.begin(); b2 != F.end(); b2++){
-                        BasicBlock *BB2 = &(*b2);
-                        if (bb_info_mapper[BB]->strict_dominators[value_mapper[BB2]] == true){
-                            p_list.push_back(BB2);
-                        }
-                    }
-                    
-                    for (unsigned i = 0 ; i < p_list.size(); i++){
-                        isImmDom = true;
-                        for (unsigned j = 0 ; j < p_list.size(); j++){
-                            if (i != j){
-                                // check whether p_list[j] is a strict dominator of p_list[i]
-                                if (bb_info_mapper[p_list[i]]->
-                                    strict_dominators[value_mapper[p_list[j]]] != true){
-                                // if not, then p_list[i] is not an immediate dominator of BB
-                                    isImmDom = false;
-                                    break;
-                                }
-                            }
-                        }
-                        if (isImmDom){
-                            bb_info_mapper[BB]->immediate_dominators[value_mapper[p_list[i]]] = true;
+            
+            for (unsigned i = 0 ; i < p_list.size(); i++){
+                isImmDom = true;
+                for (unsigned j = 0 ; j < p_list.size(); j++){
+                    if (i != j){
+                        // check whether p_list[j] is a strict dominator of p_list[i]
+                        if (info(p_list[i]).
+                            strict_dominators[value_mapper[p_list[j]]] != true){
+                        // if not, then p_list[i] is not an immediate dominator of BB
+                            isImmDom = false;
                             break;
                         }
                     }
                 }
-            }
-
-            // find inverse dominators
-            for (Function::iterator b = F.begin(); b != F.end(); b++){
-                BasicBlock *curr_bb = &(*b);
-                for (Function::iterator b2 = F.begin(); b2 != F.end(); b2++){
-                    BasicBlock *other_bb = &(*b);
-                    if (bb_info_mapper[other_bb]->dominators[value_mapper[curr_bb]] == true){
-                        bb_info_mapper[curr_bb]->inverse_dominators[value_mapper[other_bb]] = true;
-                    }
+                if (isImmDom){
+                    info(BB).immediate_dominators[value_mapper[p_list[i]]] = true;
+                    break;
                 }
             }
+        }
+    }
 
-            // print out result
-            for (Function::iterator b = F.begin(); b != F.end(); b++){
-                BasicBlock *BB = &(*b);
-                printResult(BB);
+    // find inverse dominators
+    for (Function::iterator b = F.begin(); b != F.end(); b++){
+        BasicBlock *curr_bb = &(*b);
+        for (Function::iterator b2 = F.begin(); b2 != F.end(); b2++){
+            BasicBlock *other_bb = &(*b);
+            if (info(other_bb).dominators[value_mapper[curr_bb]] == true){
+                info(curr_bb).inverse_dominators[value_mapper[other_bb]] = true;
             }
-
-            return false;
         }
-    };
+    }
+}
+
+void bso_dominance_info::print(raw_ostream &O, Function &F){
+    for (Function::iterator b = F.begin(); b != F.end(); b++){
+        BasicBlock *BB = &(*b);
+        printResult(O, BB);
+    }
 }
 
+// ---- new pass manager ----
+
+AnalysisKey bso_dominance_analysis::Key;
+
+bso_dominance_info bso_dominance_analysis::run(Function &F, FunctionAnalysisManager &AM){
+    bso_dominance_info info;
+    info.compute(F);
+    return info;
+}
+
+PreservedAnalyses bso_dominance_printer_pass::run(Function &F, FunctionAnalysisManager &AM){
+    AM.getResult<bso_dominance_analysis>(F).print(errs(), F);
+    return PreservedAnalyses::all();
+}
+
+// ---- legacy pass manager ----
+
+void bso_dominance_wrapper::getAnalysisUsage(AnalysisUsage &AU) const{
+    AU.setPreservesAll();
+}
+
+bool bso_dominance_wrapper::runOnFunction(Function &F){
+    info.reset(new bso_dominance_info);
+    info->compute(F);
+    this->F = &F;
+    return false;
+}
+
+void bso_dominance_wrapper::releaseMemory(){
+    info.reset();
+    F = nullptr;
+}
+
+void bso_dominance_wrapper::print(raw_ostream &O, const Module *M) const{
+    if (info) info->print(O, *F);
+}
 
-char bso_dominance_analysis::ID = 0;
-static RegisterPass<bso_dominance_analysis> D("bso_dominance_analysis","BSO: Iterative Algorithm for Dominance Analysis");
+char bso_dominance_wrapper::ID = 0;
+static RegisterPass<bso_dominance_wrapper> D("bso_dominance_analysis","BSO: Iterative Algorithm for Dominance Analysis");
@@ -0,0 +1,78 @@
+// Goal : Iterative dominance analysis. For each BB : dominators, immediate
+// dominator, inverse dominators and strict dominators, as bit vectors indexed by
+// the position of the block in the function.
+
+#ifndef BSO_DOMINANCE_ANALYSIS_H
+#define BSO_DOMINANCE_ANALYSIS_H
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/PassManager.h"
+#include <memory>
+#include <vector>
+
+// the analysis result, shared by both pass managers
+struct bso_dominance_info{
+    struct bb_info{
+        llvm::BasicBlock* BB;
+        std::vector<bool> dominators;
+        std::vector<bool> strict_dominators;
+        std::vector<bool> immediate_dominators;
+        std::vector<bool> inverse_dominators;
+    };
+
+    llvm::DenseMap<llvm::BasicBlock*, unsigned> value_mapper;  // maps BB to location on bit vector
+    std::vector<bb_info> blocks;    // indexed by the location on the bit vector
+
+    bso_dominance_info() {};
+    bso_dominance_info(bso_dominance_info &&other) = default;
+    bso_dominance_info &operator=(bso_dominance_info &&other) = default;
+
+    // compute() starts over, so one result can be reused from function to function
+    void compute(llvm::Function &F);
+    void reset();
+    void print(llvm::raw_ostream &O, llvm::Function &F);
+
+    // new pass manager: only depends on the CFG
+    bool invalidate(llvm::Function &F, const llvm::PreservedAnalyses &PA,
+                    llvm::FunctionAnalysisManager::Invalidator &Inv);
+
+private:
+    bb_info &info(llvm::BasicBlock *BB) { return blocks[value_mapper[BB]]; }
+    bool isEqual(const std::vector<bool> &a, const std::vector<bool> &b);
+    std::vector<bool> meet(const std::vector<llvm::BasicBlock*> &bb_list);
+    std::vector<bool> un(llvm::BasicBlock* BB, std::vector<bool> p_list);
+    void printBitVector(llvm::raw_ostream &O, const std::vector<bool> &b);
+    void printResult(llvm::raw_ostream &O, llvm::BasicBlock* BB);
+};
+
+// new pass manager analysis
+struct bso_dominance_analysis : public llvm::AnalysisInfoMixin<bso_dominance_analysis>{
+    typedef bso_dominance_info Result;
+    bso_dominance_info run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    static llvm::AnalysisKey Key;
+};
+
+struct bso_dominance_printer_pass : public llvm::PassInfoMixin<bso_dominance_printer_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// legacy pass manager wrapper, prints the result with opt -analyze
+struct bso_dominance_wrapper : public llvm::FunctionPass{
+    static char ID;
+    bso_dominance_wrapper() : llvm::FunctionPass(ID) {};
+
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+    bool runOnFunction(llvm::Function &F) override;
+    void releaseMemory() override;
+    void print(llvm::raw_ostream &O, const llvm::Module *M) const override;
+
+    bso_dominance_info &getInfo() { return *info; }
+
+private:
+    std::unique_ptr<bso_dominance_info> info;
+    llvm::Function *F = nullptr;
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "passes.h"
+#include "phaseTimer.h"
+
+#include <algorithm>
+#include <vector>
+
+// dead store elimination: a store is dead when a later store writes at least the
+// same bytes before anything can read them, later in its block or in a block that
+// post dominates it with the same address on every path, or when it writes to an
+// alloca nobody ever reads. Then the
+// runs of adjacent narrow constant stores left are merged into wider stores.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_dse"
+STATISTIC(NumLocalDead, "# of stores overwritten later in their block");
+STATISTIC(NumPostDomDead, "# of stores overwritten in a post dominating block");
+STATISTIC(NumAllocaDead, "# of stores to allocas that are never read");
+STATISTIC(NumMerged, "# of narrow stores merged into wider ones");
+
+static cl::opt<unsigned> ScanLimit("bso-dse-scan-limit", cl::init(64), cl::Hidden,
+        cl::desc("BSO: later stores a store is checked against, and blocks searched "
+                 "between a store and the one overwriting it"));
+
+namespace{
+    // the bytes a store writes: [offset, offset + size) from base
+    struct store_loc{
+        Value *base;
+        int64_t offset;
+        uint64_t size;
+    };
+
+    // shared by the legacy and the new pass manager passes
+    struct bso_dse_impl{
+        AAResults &AA;
+        PostDominatorTree &PDT;
+        LoopInfo &LI;
+        OptimizationRemarkEmitter &ORE;
+        const DataLayout &DL;
+
+        bso_dse_impl(AAResults &AA, PostDominatorTree &PDT, LoopInfo &LI,
+                     OptimizationRemarkEmitter &ORE, const DataLayout &DL)
+            : AA(AA), PDT(PDT), LI(LI), ORE(ORE), DL(DL) {};
+
+        store_loc getLoc(StoreInst *SI){
+            store_loc loc;
+            loc.offset = 0;
+            loc.base = GetPointerBaseWithConstantOffset(SI->getPointerOperand(), loc.offset, DL);
+            loc.size = DL.getTypeStoreSize(SI->getValueOperand()->getType());
+            return loc;
+        }
+
+        // K writes every byte S writes
+        bool overwrites(StoreInst *K, StoreInst *S){
+            store_loc k = getLoc(K);
+            store_loc s = getLoc(S);
+            if (k.base == s.base){
+                return k.offset <= s.offset and s.offset + s.size <= k.offset + k.size;
+            }
+            return k.size >= s.size and
+                   AA.alias(MemoryLocation::get(K), MemoryLocation::get(S)) == MustAlias;
+        }
+
+        // I may let the value S stored be seen: by reading it, or by unwinding
+        // to a caller that can
+        bool mayObserve(Instruction *I, StoreInst *S){
+            if (I->mayThrow()) return true;
+            if (!I->mayReadFromMemory()) return false;
+            return isRefSet(AA.getModRefInfo(I, MemoryLocation::get(S)));
+        }
+
+        void removeStore(StoreInst *S, StoreInst *K, StringRef where){
+            LLVM_DEBUG(dbgs() << "bso_dse: " << *S << " overwritten by" << *K << "\n");
+            ORE.emit([&]{
+                return OptimizationRemark(DEBUG_TYPE, "DeadStore", S)
+                    << "store removed: overwritten " << where << " before anything reads it";
+            });
+        }
+
+        // ---- stores to allocas nobody reads ----
+
+        bool removeUnreadAlloca(AllocaInst *AI){
+            std::vector<Instruction*> stores;
+            std::vector<Instruction*> addrs;
+            std::vector<Value*> worklist;
+            worklist.push_back(AI);
+            while (!worklist.empty()){
+                Value *V = worklist.back();
+                worklist.pop_back();
+                for (User *U : V->users()){
+                    Instruction *I = cast<Instruction>(U);
+                    StoreInst *SI = dyn_cast<StoreInst>(I);
+                    if (SI != NULL and SI->getPointerOperand() == V and
+                        SI->getValueOperand() != V and SI->isSimple()){
+                        stores.push_back(SI);
+                    }else if (isa<GetElementPtrInst>(I) or isa<BitCastInst>(I)){
+                        addrs.push_back(I);
+                        worklist.push_back(I);
+                    }else if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(I)){
+                        if (II->getIntrinsicID() != Intrinsic::lifetime_start and
+                            II->getIntrinsicID() != Intrinsic::lifetime_end){
+                            return false;
+                        }
+                        stores.push_back(II);
+                    }else{
+                        // read, or the address escapes
+                        return false;
+                    }
+                }
+            }
+            if (stores.empty()) return false;
+
+            ORE.emit([&]{
+                return OptimizationRemark(DEBUG_TYPE, "UnreadAlloca", AI)
+                    << "removed the stores to " << ore::NV("Alloca", AI)
+                    << ": it is never read";
+            });
+            for (Instruction *I : stores){
+                if (isa<StoreInst>(I)) ++NumAllocaDead;
+                I->eraseFromParent();
+            }
+            for (Instruction *I : addrs) I->dropAllReferences();
+            for (Instruction *I : addrs) I->eraseFromParent();
+            AI->eraseFromParent();
+            return true;
+        }
+
+        bool removeUnreadAllocas(Function &F){
+            std::vector<AllocaInst*> allocas;
+            bool isChanged = false;
+            for (Instruction &I : F.getEntryBlock()){
+                if (AllocaInst *AI = dyn_cast<AllocaInst>(&I)) allocas.push_back(AI);
+            }
+            for (AllocaInst *AI : allocas) isChanged |= removeUnreadAlloca(AI);
+            return isChanged;
+        }
+
+        // ---- within a block ----
+
+        // walk the block backwards keeping the stores below that nothing has
+        // read since, nearest last; a store one of them overwrites is dead
+        bool runOnBlock(BasicBlock &BB){
+            std::vector<StoreInst*> later;
+            bool isChanged = false;
+            for (BasicBlock::iterator it = BB.end(); it != BB.begin(); ){
+                Instruction *I = &*--it;
+                StoreInst *SI = dyn_cast<StoreInst>(I);
+                if (SI != NULL and SI->isSimple()){
+                    StoreInst *killer = NULL;
+                    for (auto K = later.rbegin(); K != later.rend() and killer == NULL; ++K){
+                        if (overwrites(*K, SI)) killer = *K;
+                    }
+                    if (killer != NULL){
+                        removeStore(SI, killer, "later in the block");
+                        it = SI->eraseFromParent();
+                        ++NumLocalDead;
+                        isChanged = true;
+                        continue;
+                    }
+                    later.push_back(SI);
+                    if (later.size() > ScanLimit) later.erase(later.begin());
+                    continue;
+                }
+                later.erase(std::remove_if(later.begin(), later.end(), [&](StoreInst *K){
+                                return mayObserve(I, K);
+                            }), later.end());
+            }
+            return isChanged;
+        }
+
+        // ---- across blocks ----
+
+        // nothing between S and K, K in a block post dominating S's, observes S
+        bool isPathClear(StoreInst *S, StoreInst *K){
+            BasicBlock *from = S->getParent();
+            BasicBlock *to = K->getParent();
+            for (BasicBlock::iterator it = ++S->getIterator(); it != from->end(); ++it){
+                if (mayObserve(&*it, S)) return false;
+            }
+            for (BasicBlock::iterator it = to->begin(); &*it != K; ++it){
+                if (mayObserve(&*it, S)) return false;
+            }
+            // every block control can pass through on its way to K's
+            SmallPtrSet<BasicBlock*, 16> seen;
+            std::vector<BasicBlock*> stack(succ_begin(from), succ_end(from));
+            while (!stack.empty()){
+                BasicBlock *BB = stack.back();
+                stack.pop_back();
+                if (BB == to or !seen.insert(BB).second) continue;
+                if (seen.size() > ScanLimit) return false;
+                for (Instruction &I : *BB){
+                    if (mayObserve(&I, S)) return false;
+                }
+                for (BasicBlock *succ : successors(BB)) stack.push_back(succ);
+            }
+            return true;
+        }
+
+        // K writes where S did wherever they run. Within one block they see the same
+        // values; across blocks a base redefined by a loop around either, like
+        // gep %a, %i, lets K write another element than the one S wrote
+        bool isSameAddress(StoreInst *S, StoreInst *K){
+            Value *bases[] = {getLoc(S).base, getLoc(K).base};
+            for (StoreInst *SI : {S, K}){
+                Loop *L = LI.getLoopFor(SI->getParent());
+                if (L == NULL) continue;
+                while (L->getParentLoop() != NULL) L = L->getParentLoop();
+                for (Value *base : bases){
+                    if (!L->isLoopInvariant(base)) return false;
+                }
+            }
+            return true;
+        }
+
+        bool runAcrossBlocks(Function &F){
+            DenseMap<Value*, std::vector<StoreInst*> > by_base;
+            std::vector<StoreInst*> stores;
+            SmallPtrSet<StoreInst*, 16> removed;
+            bool isChanged = false;
+            for (BasicBlock &BB : F){
+                if (PDT.getNode(&BB) == NULL) continue;
+                for (Instruction &I : BB){
+                    StoreInst *SI = dyn_cast<StoreInst>(&I);
+                    if (SI == NULL or !SI->isSimple()) continue;
+                    stores.push_back(SI);
+                    by_base[getLoc(SI).base].push_back(SI);
+                }
+            }
+            for (StoreInst *S : stores){
+                std::vector<StoreInst*> &candidates = by_base[getLoc(S).base];
+                unsigned tried = 0;
+                for (StoreInst *K : candidates){
+                    if (K == S or removed.count(K) or K->getParent() == S->getParent()) continue;
+                    if (!PDT.dominates(K->getParent(), S->getParent())) continue;
+                    if (!overwrites(K, S) or !isSameAddress(S, K)) continue;
+                    if (++tried > ScanLimit) break;
+                    if (!isPathClear(S, K)) continue;
+                    removeStore(S, K, "in a block that always follows");
+                    removed.insert(S);
+                    ++NumPostDomDead;
+                    isChanged = true;
+                    break;
+                }
+            }
+            for (StoreInst *S : removed) S->eraseFromParent();
+            return isChanged;
+        }
+
+        // ---- store merging ----
+
+        struct narrow_store{
+            StoreInst *SI;
+            store_loc loc;
+            unsigned order;     // position in the run
+        };
+
+        // replace run[begin, end), adjacent in memory, by one wide store placed
+        // after the last of them
+        void mergeStores(std::vector<narrow_store> &run, unsigned begin, unsigned end){
+            narrow_store &first = run[begin];
+            StoreInst *last = first.SI;
+            unsigned last_order = first.order;
+            uint64_t bytes = 0;
+            for (unsigned i = begin; i < end; i++){
+                bytes += run[i].loc.size;
+                if (run[i].order >= last_order){
+                    last_order = run[i].order;
+                    last = run[i].SI;
+                }
+            }
+            APInt value(bytes * 8, 0);
+            for (unsigned i = begin; i < end; i++){
+                ConstantInt *C = cast<ConstantInt>(run[i].SI->getValueOperand());
+                uint64_t pos = run[i].loc.offset - first.loc.offset;
+                if (!DL.isLittleEndian()) pos = bytes - pos - run[i].loc.size;
+                value |= C->getValue().zext(bytes * 8).shl(pos * 8);
+            }
+
+            IRBuilder<> B(last->getNextNode());
+            Value *ptr = first.SI->getPointerOperand();
+            unsigned AS = ptr->getType()->getPointerAddressSpace();
+            Type *wide = IntegerType::get(B.getContext(), bytes * 8);
+            unsigned align = first.SI->getAlignment();
+            if (align == 0) align = DL.getABITypeAlignment(first.SI->getValueOperand()->getType());
+            StoreInst *merged = B.CreateStore(ConstantInt::get(wide, value),
+                                              B.CreateBitCast(ptr, wide->getPointerTo(AS)));
+            merged->setAlignment(align);
+            ORE.emit([&]{
+                return OptimizationRemark(DEBUG_TYPE, "StoresMerged", merged)
+                    << ore::NV("NumStores", end - begin) << " adjacent constant stores merged into one "
+                    << ore::NV("Bits", (unsigned)bytes * 8) << " bit store";
+            });
+            for (unsigned i = begin; i < end; i++){
+                run[i].SI->eraseFromParent();
+                ++NumMerged;
+            }
+        }
+
+        // the stores of run write disjoint bytes of one base with nothing in between
+        // touching memory; merge what is adjacent into stores of legal integer widths
+        bool flushRun(std::vector<narrow_store> &run){
+            bool isChanged = false;
+            uint64_t max_bytes = DL.getLargestLegalIntTypeSizeInBits() / 8;
+            std::sort(run.begin(), run.end(), [](const narrow_store &a, const narrow_store &b){
+                return a.loc.offset < b.loc.offset;
+            });
+            unsigned i = 0;
+            while (i < run.size()){
+                // the longest adjacent prefix from i that fills a legal integer
+                unsigned best = i;
+                uint64_t bytes = run[i].loc.size;
+                for (unsigned j = i + 1; j < run.size(); j++){
+                    if (run[j].loc.offset != run[j - 1].loc.offset + (int64_t)run[j - 1].loc.size) break;
+                    bytes += run[j].loc.size;
+                    if (bytes > max_bytes) break;
+                    if (isPowerOf2_64(bytes) and DL.isLegalInteger(bytes * 8)) best = j;
+                }
+                if (best > i){
+                    mergeStores(run, i, best + 1);
+                    isChanged = true;
+                    i = best + 1;
+                }else{
+                    i++;
+                }
+            }
+            run.clear();
+            return isChanged;
+        }
+
+        bool mergeNarrowStores(BasicBlock &BB){
+            std::vector<narrow_store> run;
+            std::vector<Instruction*> insts;
+            bool isChanged = false;
+            for (Instruction &I : BB) insts.push_back(&I);
+            for (Instruction *I : insts){
+                StoreInst *SI = dyn_cast<StoreInst>(I);
+                bool is_narrow = SI != NULL and SI->isSimple() and isa<ConstantInt>(SI->getValueOperand());
+                if (is_narrow){
+                    Type *T = SI->getValueOperand()->getType();
+                    is_narrow = DL.getTypeSizeInBits(T) % 8 == 0 and
+                                DL.getTypeStoreSizeInBits(T) == DL.getTypeSizeInBits(T);
+                }
+                if (!is_narrow){
+                    if (I->mayReadOrWriteMemory() or I->mayThrow()) isChanged |= flushRun(run);
+                    continue;
+                }
+                narrow_store ns = {SI, getLoc(SI), (unsigned)run.size()};
+                bool is_overlap = false;
+                for (narrow_store &other : run){
+                    is_overlap |= ns.loc.offset < other.loc.offset + (int64_t)other.loc.size and
+                                  other.loc.offset < ns.loc.offset + (int64_t)ns.loc.size;
+                }
+                if (!run.empty() and (run[0].loc.base != ns.loc.base or is_overlap)){
+                    isChanged |= flushRun(run);
+                    ns.order = 0;
+                }
+                run.push_back(ns);
+            }
+            isChanged |= flushRun(run);
+            return isChanged;
+        }
+
+        bool runOnFunction(Function &F){
+            bool isChanged = false;
+            {
+                bso_phase_timer timer("bso_dse.allocas", "BSO DSE: stores to unread allocas");
+                isChanged |= removeUnreadAllocas(F);
+            }
+            {
+                bso_phase_timer timer("bso_dse.local", "BSO DSE: within blocks");
+                for (BasicBlock &BB : F) isChanged |= runOnBlock(BB);
+            }
+            {
+                bso_phase_timer timer("bso_dse.post_dom", "BSO DSE: across blocks");
+                isChanged |= runAcrossBlocks(F);
+            }
+            {
+                bso_phase_timer timer("bso_dse.merge", "BSO DSE: merge narrow stores");
+                for (BasicBlock &BB : F) isChanged |= mergeNarrowStores(BB);
+            }
+            return isChanged;
+        }
+    };
+
+    struct bso_dse : public FunctionPass{
+        static char ID;
+        bso_dse() : FunctionPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.setPreservesCFG();
+            AU.addRequired<AAResultsWrapperPass>();
+            AU.addRequired<PostDominatorTreeWrapperPass>();
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+        }
+
+        bool runOnFunction(Function &F) override{
+            bso_dse_impl impl(getAnalysis<AAResultsWrapperPass>().getAAResults(),
+                              getAnalysis<PostDominatorTreeWrapperPass>().getPostDomTree(),
+                              getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                              getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE(),
+                              F.getParent()->getDataLayout());
+            return impl.runOnFunction(F);
+        }
+    };
+}
+
+PreservedAnalyses bso_dse_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_dse_impl impl(AM.getResult<AAManager>(F),
+                      AM.getResult<PostDominatorTreeAnalysis>(F),
+                      AM.getResult<LoopAnalysis>(F),
+                      AM.getResult<OptimizationRemarkEmitterAnalysis>(F),
+                      F.getParent()->getDataLayout());
+    if (!impl.runOnFunction(F)) return PreservedAnalyses::all();
+    // only stores, and the addresses of unread allocas, are removed or added
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
+
+std::string bso_dse_pass::options(){
+    return "bso-dse-scan-limit=" + std::to_string(ScanLimit);
+}
+
+char bso_dse::ID = 0;
+static RegisterPass<bso_dse> D("bso_dse", "BSO: Dead Store Elimination");
@@ -0,0 +1,318 @@
+#include "functionCache.h"
+#include "functionExtract.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <dlfcn.h>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_cache"
+STATISTIC(NumHits, "# of functions whose optimized body came from the cache");
+STATISTIC(NumMisses, "# of functions looked up in the cache and not found");
+STATISTIC(NumStores, "# of optimized bodies written to the cache");
+STATISTIC(NumEvictions, "# of cache entries evicted to stay within the size limit");
+STATISTIC(NumUncacheable, "# of functions the cache cannot hold");
+
+static cl::opt<std::string> CacheDir("bso-cache-dir", cl::init(""), cl::Hidden,
+        cl::desc("BSO: reuse the optimized function bodies kept in this directory (empty = no cache)"));
+static cl::opt<unsigned> CacheSizeMB("bso-cache-size-mb", cl::init(512), cl::Hidden,
+        cl::desc("BSO: size the cache directory is trimmed to, in megabytes"));
+
+// the plugin's own binary: any rebuild of the passes is a new version
+static std::string getPluginVersion(){
+    MD5 hash;
+    MD5::MD5Result res;
+    Dl_info info;
+    hash.update(LLVM_VERSION_STRING);
+    if (dladdr((void*)&getPluginVersion, &info) != 0 and info.dli_fname != NULL){
+        ErrorOr<std::unique_ptr<MemoryBuffer> > binary = MemoryBuffer::getFile(info.dli_fname);
+        if (binary) hash.update((*binary)->getBuffer());
+    }else{
+        hash.update(__DATE__ " " __TIME__);
+    }
+    hash.final(res);
+    return res.digest().c_str();
+}
+
+static sys::TimePoint<> now(){
+    return std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now());
+}
+
+// the named structs T is built from, their layout is part of the key
+static void collectType(Type *T, SmallPtrSetImpl<Type*> &seen, std::vector<StructType*> &structs){
+    if (!seen.insert(T).second) return;
+    StructType *ST = dyn_cast<StructType>(T);
+    if (ST != NULL and !ST->isLiteral()) structs.push_back(ST);
+    for (Type *sub : T->subtypes()) collectType(sub, seen, structs);
+}
+
+// what F and its instructions have attached, !prof and !tbaa included: F.print()
+// only names the nodes. They are numbered by first use, not by their slot in the
+// module, so the same function hashes the same next to other functions
+static void printMetadata(Function &F, raw_ostream &OS){
+    DenseMap<MDNode*, unsigned> ids;
+    std::vector<MDNode*> nodes;
+    auto getId = [&](MDNode *N){
+        auto it = ids.insert(std::make_pair(N, (unsigned)nodes.size()));
+        if (it.second) nodes.push_back(N);
+        return it.first->second;
+    };
+    // kinds by name, the ids of custom ones depend on the order they were registered
+    SmallVector<StringRef, 32> kinds;
+    F.getContext().getMDKindNames(kinds);
+    SmallVector<std::pair<unsigned, MDNode*>, 8> attached;
+    F.getAllMetadata(attached);
+    for (auto &md : attached) OS << "F " << kinds[md.first] << " !" << getId(md.second) << "\n";
+    unsigned n = 0;
+    for (Instruction &I : instructions(F)){
+        // left alone when I has none
+        attached.clear();
+        I.getAllMetadata(attached);
+        for (auto &md : attached) OS << n << " " << kinds[md.first] << " !" << getId(md.second) << "\n";
+        n++;
+    }
+    // operands are numbered as they come up, the loop picks them up after
+    for (unsigned i = 0; i < nodes.size(); i++){
+        MDNode *N = nodes[i];
+        OS << "!" << i << " =" << (N->isDistinct() ? " distinct " : " ") << N->getMetadataID();
+        for (const MDOperand &op : N->operands()){
+            Metadata *MD = op.get();
+            if (MD == NULL){
+                OS << " null";
+            }else if (MDNode *sub = dyn_cast<MDNode>(MD)){
+                OS << " !" << getId(sub);
+            }else if (MDString *str = dyn_cast<MDString>(MD)){
+                OS << " \"" << str->getString() << "\"";
+            }else if (ValueAsMetadata *V = dyn_cast<ValueAsMetadata>(MD)){
+                OS << " ";
+                V->getValue()->printAsOperand(OS);
+            }else{
+                OS << " ?" << MD->getMetadataID();
+            }
+        }
+        OS << "\n";
+    }
+}
+
+// ---- the cache ----
+
+bso_function_cache *bso_function_cache::get(){
+    if (CacheDir.empty()) return NULL;
+    static bso_function_cache cache(CacheDir, (uint64_t)CacheSizeMB << 20);
+    return &cache;
+}
+
+bso_function_cache::bso_function_cache(StringRef dir, uint64_t limit)
+    : dir(dir), limit(limit), version(getPluginVersion()){
+    sys::fs::create_directories(dir);
+    scan();
+}
+
+std::string bso_function_cache::getPath(StringRef key){
+    SmallString<128> path(dir);
+    sys::path::append(path, key + ".bc");
+    return path.c_str();
+}
+
+// pick up the entries earlier runs left behind
+void bso_function_cache::scan(){
+    std::error_code EC;
+    for (sys::fs::directory_iterator it(dir, EC), end; !EC and it != end; it.increment(EC)){
+        if (sys::path::extension(it->path()) != ".bc") continue;
+        ErrorOr<sys::fs::basic_file_status> st = it->status();
+        if (!st) continue;
+        entry &e = entries[sys::path::stem(it->path())];
+        e.size = st->getSize();
+        e.used = st->getLastModificationTime();
+        total += e.size;
+    }
+}
+
+bool bso_function_cache::isCacheable(Function &F){
+    if (F.isDeclaration()) return false;
+    bool is_cacheable = isExtractable(F);
+    if (!is_cacheable) ++NumUncacheable;
+    return is_cacheable;
+}
+
+// F.print() covers the body; what it only names, the attributes of the
+// function and its callees, the layout of its types and its metadata, is
+// hashed next to it
+std::string bso_function_cache::getKey(Function &F, StringRef pipeline){
+    std::string text;
+    raw_string_ostream OS(text);
+    Module &M = *F.getParent();
+    SetVector<GlobalValue*> globals;
+    SmallPtrSet<Type*, 32> seen;
+    std::vector<StructType*> structs;
+
+    OS << version << "\n" << pipeline << "\n" << M.getTargetTriple() << "\n"
+       << M.getDataLayoutStr() << "\n";
+    OS << F.getAttributes().getAsString(AttributeList::FunctionIndex) << "\n";
+    collectGlobals(F, globals);
+    collectType(F.getType(), seen, structs);
+    for (GlobalValue *GV : globals){
+        OS << GV->getName() << " : " << *GV->getValueType();
+        if (Function *callee = dyn_cast<Function>(GV)){
+            OS << " " << callee->getAttributes().getAsString(AttributeList::FunctionIndex);
+        }
+        GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV);
+        if (GVar != NULL and GVar->isConstant() and GVar->hasDefinitiveInitializer()){
+            OS << " = " << *GVar->getInitializer();
+        }
+        OS << "\n";
+        collectType(GV->getType(), seen, structs);
+    }
+    for (BasicBlock &BB : F){
+        for (Instruction &I : BB){
+            collectType(I.getType(), seen, structs);
+            for (Value *op : I.operands()) collectType(op->getType(), seen, structs);
+            if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)){
+                collectType(GEP->getSourceElementType(), seen, structs);
+            }else if (auto *AI = dyn_cast<AllocaInst>(&I)){
+                collectType(AI->getAllocatedType(), seen, structs);
+            }
+        }
+    }
+    for (StructType *ST : structs){
+        OS << ST->getName() << " =" << (ST->isPacked() ? " packed" : "");
+        if (ST->isOpaque()) OS << " opaque";
+        for (Type *elt : ST->elements()) OS << " " << *elt;
+        OS << "\n";
+    }
+    printMetadata(F, OS);
+    F.print(OS);
+    OS.flush();
+
+    MD5 hash;
+    MD5::MD5Result res;
+    hash.update(text);
+    hash.final(res);
+    return res.digest().c_str();
+}
+
+bool bso_function_cache::lookup(Function &F, StringRef key){
+    std::string path = getPath(key);
+    std::unique_ptr<Module> cached;
+    sys::fs::file_status st;
+    int fd;
+
+    if (sys::fs::openFileForRead(path, fd)){
+        ++NumMisses;
+        return false;
+    }
+    std::error_code EC = sys::fs::status(fd, st);
+    if (!EC and st.getSize() != 0){
+        // the entry is parsed straight out of the mapping, nothing is copied first
+        sys::fs::mapped_file_region region(fd, sys::fs::mapped_file_region::readonly,
+                                           st.getSize(), 0, EC);
+        if (!EC){
+            MemoryBufferRef buffer(StringRef(region.const_data(), st.getSize()), path);
+            Expected<std::unique_ptr<Module> > parsed = parseBitcodeFile(buffer, F.getContext());
+            if (parsed){
+                cached = std::move(*parsed);
+            }else{
+                consumeError(parsed.takeError());
+            }
+        }
+    }
+    // the modification time is what the eviction goes by
+    if (cached) sys::fs::setLastModificationAndAccessTime(fd, now());
+    sys::Process::SafelyCloseFileDescriptor(fd);
+
+    if (!cached){
+        // truncated or written by another LLVM, make room for a good one
+        sys::fs::remove(path);
+        ++NumMisses;
+        return false;
+    }
+    Function *funcs[] = {&F};
+    if (!spliceFunctions(funcs, *cached)){
+        ++NumMisses;
+        return false;
+    }
+    touch(key, st.getSize());
+    ++NumHits;
+    return true;
+}
+
+void bso_function_cache::store(Function &F, StringRef key){
+    Function *funcs[] = {&F};
+    std::unique_ptr<Module> entry = extractFunctions(funcs);
+    SmallString<128> tmp_path;
+    uint64_t size;
+    int fd;
+
+    // written next to its final place and renamed, so readers never see half an entry
+    if (sys::fs::createUniqueFile(dir + "/%%%%%%%%%%%%.tmp", fd, tmp_path)) return;
+    {
+        raw_fd_ostream OS(fd, true);
+        WriteBitcodeToFile(*entry, OS);
+        size = OS.tell();
+        OS.close();
+        if (OS.has_error()){
+            OS.clear_error();
+            sys::fs::remove(tmp_path);
+            return;
+        }
+    }
+    if (sys::fs::rename(tmp_path, getPath(key))){
+        sys::fs::remove(tmp_path);
+        return;
+    }
+    ++NumStores;
+    touch(key, size);
+}
+
+void bso_function_cache::touch(StringRef key, uint64_t size){
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it != entries.end()) total -= it->second.size;
+    entry &e = entries[key];
+    e.size = size;
+    e.used = now();
+    total += size;
+    if (total > limit) evict();
+}
+
+// least recently used first, down to 90% of the limit so that the next few
+// stores do not evict again; called with the lock held
+void bso_function_cache::evict(){
+    std::vector<std::pair<sys::TimePoint<>, StringRef> > order;
+    for (auto &it : entries){
+        order.push_back(std::make_pair(it.second.used, it.first()));
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<std::string> victims;
+    for (auto &it : order){
+        if (total <= limit / 10 * 9) break;
+        victims.push_back(it.second.str());
+        total -= entries[it.second].size;
+    }
+    for (std::string &key : victims){
+        sys::fs::remove(getPath(key));
+        entries.erase(key);
+        ++NumEvictions;
+    }
+}
@@ -0,0 +1,52 @@
+// Goal : Opt-in on-disk cache of optimized function bodies (-bso-cache-dir=<dir>).
+// An entry is keyed by a hash of the function's IR, the pipeline that optimized
+// it and the plugin build. On a hit the cached body is spliced into the function
+// and the pipeline does not run. Entries are bitcode files named after their key,
+// read through mmap and evicted least recently used first once the directory
+// grows past -bso-cache-size-mb.
+
+#ifndef BSO_FUNCTION_CACHE_H
+#define BSO_FUNCTION_CACHE_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/Chrono.h"
+
+#include <mutex>
+#include <string>
+
+class bso_function_cache{
+public:
+    // the process wide cache, NULL unless -bso-cache-dir is given
+    static bso_function_cache *get();
+
+    // functions with debug info, block addresses or unnamed globals stay out
+    bool isCacheable(llvm::Function &F);
+    std::string getKey(llvm::Function &F, llvm::StringRef pipeline);
+    // on a hit F's body is replaced by the cached one
+    bool lookup(llvm::Function &F, llvm::StringRef key);
+    void store(llvm::Function &F, llvm::StringRef key);
+
+private:
+    struct entry{
+        uint64_t size;
+        llvm::sys::TimePoint<> used;
+    };
+
+    std::string dir;
+    uint64_t limit;
+    std::string version;        // identifies the plugin build
+    std::mutex lock;            // guards entries and total
+    llvm::StringMap<entry> entries;
+    uint64_t total = 0;
+
+    bso_function_cache(llvm::StringRef dir, uint64_t limit);
+    std::string getPath(llvm::StringRef key);
+    void scan();
+    void touch(llvm::StringRef key, uint64_t size);
+    void evict();
+};
+
+#endif
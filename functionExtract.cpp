@@ -0,0 +1,234 @@
+#include "functionExtract.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/TypeFinder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <vector>
+
+using namespace llvm;
+
+// named metadata of an extracted module: the names its struct types had, a
+// context renames them on the way back in when they already exist
+static const char *TypeNames = "bso.types";
+
+static void collectConstant(Constant *C, SmallPtrSetImpl<Constant*> &seen,
+                            SetVector<GlobalValue*> &globals){
+    if (!seen.insert(C).second) return;
+    if (GlobalValue *GV = dyn_cast<GlobalValue>(C)){
+        globals.insert(GV);
+        return;
+    }
+    for (Value *op : C->operands()){
+        if (Constant *c = dyn_cast<Constant>(op)) collectConstant(c, seen, globals);
+    }
+}
+
+void collectGlobals(Function &F, SetVector<GlobalValue*> &globals){
+    SmallPtrSet<Constant*, 32> seen;
+    if (F.hasPersonalityFn()) collectConstant(F.getPersonalityFn(), seen, globals);
+    if (F.hasPrefixData()) collectConstant(F.getPrefixData(), seen, globals);
+    if (F.hasPrologueData()) collectConstant(F.getPrologueData(), seen, globals);
+    for (BasicBlock &BB : F){
+        for (Instruction &I : BB){
+            for (Value *op : I.operands()){
+                if (Constant *C = dyn_cast<Constant>(op)) collectConstant(C, seen, globals);
+            }
+        }
+    }
+}
+
+bool isExtractable(Function &F){
+    if (F.isDeclaration() or !F.hasName()) return false;
+    // debug info metadata would be duplicated on the way back in
+    if (F.getSubprogram() != NULL) return false;
+    for (BasicBlock &BB : F){
+        if (BB.hasAddressTaken()) return false;
+    }
+    SetVector<GlobalValue*> globals;
+    collectGlobals(F, globals);
+    for (GlobalValue *GV : globals){
+        // the copies find the globals they use by name
+        if (!GV->hasName()) return false;
+    }
+    return true;
+}
+
+// maps the struct types of an extracted module back to the ones of the module,
+// and every type built from them
+struct type_remapper : public ValueMapTypeRemapper{
+    DenseMap<Type*, Type*> types;
+
+    // false when a struct the extracted module needs does not exist here
+    bool seed(Module &from, Module &M){
+        NamedMDNode *names = from.getNamedMetadata(TypeNames);
+        if (names == NULL) return true;
+        for (MDNode *N : names->operands()){
+            if (N->getNumOperands() != 2) return false;
+            auto *ptr = dyn_cast<ValueAsMetadata>(N->getOperand(0));
+            auto *name = dyn_cast<MDString>(N->getOperand(1));
+            if (ptr == NULL or name == NULL) return false;
+            Type *from_type = ptr->getValue()->getType()->getPointerElementType();
+            StructType *to = M.getTypeByName(name->getString());
+            if (to == NULL) return false;
+            types[from_type] = to;
+        }
+        return true;
+    }
+
+    Type *remapType(Type *T) override{
+        auto it = types.find(T);
+        if (it != types.end()) return it->second;
+        StructType *ST = dyn_cast<StructType>(T);
+        if (ST != NULL and !ST->isLiteral()) return T;
+
+        Type *res = T;
+        SmallVector<Type*, 8> subs;
+        bool isChanged = false;
+        for (Type *sub : T->subtypes()){
+            subs.push_back(remapType(sub));
+            isChanged |= subs.back() != sub;
+        }
+        if (isChanged){
+            if (PointerType *PT = dyn_cast<PointerType>(T)){
+                res = PointerType::get(subs[0], PT->getAddressSpace());
+            }else if (ArrayType *AT = dyn_cast<ArrayType>(T)){
+                res = ArrayType::get(subs[0], AT->getNumElements());
+            }else if (VectorType *VT = dyn_cast<VectorType>(T)){
+                res = VectorType::get(subs[0], VT->getNumElements());
+            }else if (FunctionType *FT = dyn_cast<FunctionType>(T)){
+                res = FunctionType::get(subs[0], makeArrayRef(subs).slice(1), FT->isVarArg());
+            }else if (ST != NULL){
+                res = StructType::get(T->getContext(), subs, ST->isPacked());
+            }
+        }
+        types[T] = res;
+        return res;
+    }
+};
+
+static Function *declare(Function &F, Module &M, FunctionType *FTy){
+    Function *decl = Function::Create(FTy, GlobalValue::ExternalLinkage, F.getName(), &M);
+    // the attributes of a callee are what the passes know about it
+    decl->setAttributes(F.getAttributes());
+    decl->setCallingConv(F.getCallingConv());
+    return decl;
+}
+
+std::unique_ptr<Module> extractFunctions(ArrayRef<Function*> funcs){
+    Module &M = *funcs.front()->getParent();
+    LLVMContext &Ctx = M.getContext();
+    std::unique_ptr<Module> res = llvm::make_unique<Module>("bso_extracted", Ctx);
+    res->setDataLayout(M.getDataLayout());
+    res->setTargetTriple(M.getTargetTriple());
+
+    // the functions first, so that calls between them stay calls to the definitions
+    ValueToValueMapTy VMap;
+    SetVector<GlobalValue*> globals;
+    for (Function *F : funcs){
+        VMap[F] = Function::Create(F->getFunctionType(), GlobalValue::ExternalLinkage,
+                                   F->getName(), res.get());
+        collectGlobals(*F, globals);
+    }
+    // loads from constants fold to their initializer, which may refer to more globals
+    for (unsigned i = 0; i < globals.size(); i++){
+        GlobalVariable *GVar = dyn_cast<GlobalVariable>(globals[i]);
+        if (GVar != NULL and GVar->isConstant() and GVar->hasDefinitiveInitializer()){
+            SmallPtrSet<Constant*, 32> seen;
+            collectConstant(GVar->getInitializer(), seen, globals);
+        }
+    }
+    for (GlobalValue *GV : globals){
+        if (VMap.count(GV)) continue;
+        if (Function *callee = dyn_cast<Function>(GV)){
+            VMap[GV] = declare(*callee, *res, callee->getFunctionType());
+        }else{
+            GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV);
+            VMap[GV] = new GlobalVariable(*res, GV->getValueType(), GVar != NULL and GVar->isConstant(),
+                                          GlobalValue::ExternalLinkage, NULL, GV->getName(), NULL,
+                                          GlobalValue::NotThreadLocal, GV->getType()->getAddressSpace());
+        }
+    }
+    for (GlobalValue *GV : globals){
+        GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV);
+        if (GVar != NULL and GVar->isConstant() and GVar->hasDefinitiveInitializer()){
+            cast<GlobalVariable>(VMap[GV])->setInitializer(MapValue(GVar->getInitializer(), VMap));
+        }
+    }
+    for (Function *F : funcs){
+        Function *NewF = cast<Function>(VMap[F]);
+        Function::arg_iterator new_arg = NewF->arg_begin();
+        for (Argument &arg : F->args()){
+            new_arg->setName(arg.getName());
+            VMap[&arg] = &*new_arg++;
+        }
+        SmallVector<ReturnInst*, 8> returns;
+        CloneFunctionInto(NewF, F, VMap, true, returns);
+    }
+
+    TypeFinder structs;
+    structs.run(*res, false);
+    NamedMDNode *names = res->getOrInsertNamedMetadata(TypeNames);
+    for (StructType *ST : structs){
+        if (ST->isLiteral()) continue;
+        Metadata *ops[] = {ValueAsMetadata::get(UndefValue::get(PointerType::getUnqual(ST))),
+                           MDString::get(Ctx, ST->getName())};
+        names->addOperand(MDNode::get(Ctx, ops));
+    }
+    return res;
+}
+
+bool spliceFunctions(ArrayRef<Function*> funcs, Module &from){
+    Module &M = *funcs.front()->getParent();
+    type_remapper types;
+    if (!types.seed(from, M)) return false;
+
+    ValueToValueMapTy VMap;
+    std::vector<std::pair<Function*, Function*> > bodies;
+    for (Function *F : funcs){
+        Function *G = from.getFunction(F->getName());
+        if (G == NULL or G->isDeclaration()) return false;
+        if (types.remapType(G->getFunctionType()) != F->getFunctionType()) return false;
+        VMap[G] = F;
+        bodies.push_back(std::make_pair(F, G));
+    }
+
+    // everything the bodies refer to must exist here with the same type; only
+    // function declarations, e.g. intrinsics the optimized code calls, may be added
+    std::vector<Function*> missing;
+    for (GlobalValue &GV : from.global_values()){
+        if (VMap.count(&GV)) continue;
+        Type *T = types.remapType(GV.getValueType());
+        GlobalValue *target = M.getNamedValue(GV.getName());
+        if (target == NULL){
+            if (!isa<Function>(GV)) return false;
+            missing.push_back(cast<Function>(&GV));
+        }else if (target->getValueType() != T){
+            return false;
+        }else{
+            VMap[&GV] = target;
+        }
+    }
+    for (Function *decl : missing){
+        VMap[decl] = declare(*decl, M, cast<FunctionType>(types.remapType(decl->getFunctionType())));
+    }
+
+    for (auto &it : bodies){
+        Function &F = *it.first;
+        Function *G = it.second;
+        for (BasicBlock &BB : F) BB.dropAllReferences();
+        while (!F.empty()) F.begin()->eraseFromParent();
+        Function::arg_iterator arg = F.arg_begin();
+        for (Argument &new_arg : G->args()){
+            arg->setName(new_arg.getName());
+            VMap[&new_arg] = &*arg++;
+        }
+        SmallVector<ReturnInst*, 8> returns;
+        CloneFunctionInto(&F, G, VMap, true, returns, "", NULL, &types);
+    }
+    return true;
+}
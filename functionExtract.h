@@ -0,0 +1,29 @@
+// Goal : Move function bodies between modules, also across LLVMContexts through
+// bitcode. A set of functions is extracted into a module of its own with
+// declarations of everything they refer to; an optimized copy is later spliced
+// back over the originals. Used by the function cache and the parallel driver.
+
+#ifndef BSO_FUNCTION_EXTRACT_H
+#define BSO_FUNCTION_EXTRACT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include <memory>
+
+// the globals F uses, in the order it uses them
+void collectGlobals(llvm::Function &F, llvm::SetVector<llvm::GlobalValue*> &globals);
+
+// functions with debug info, block addresses or unnamed globals cannot be moved
+bool isExtractable(llvm::Function &F);
+
+// a module defining funcs, with declarations of whatever else they refer to;
+// constant globals keep their initializer
+std::unique_ptr<llvm::Module> extractFunctions(llvm::ArrayRef<llvm::Function*> funcs);
+
+// replace the bodies of funcs with the ones of the same name in from, which
+// must be in their context; nothing is touched unless all of them can be spliced
+bool spliceFunctions(llvm::ArrayRef<llvm::Function*> funcs, llvm::Module &from);
+
+#endif
@@ -1,5 +1,10 @@
 #include "llvm/Pass.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/LoopInfo.h" // analysis for loops
 #include "llvm/Analysis/LoopPass.h"
@@ -9,6 +14,9 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/Instruction.def"
 #include "llvm/IR/IRBuilder.h"
+#include "passes.h"
+#include "phaseTimer.h"
+#include "profileModel.h"
 
 #include <string>
 
@@ -16,16 +24,24 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "bso_ido"
+STATISTIC(NumInductionVars, "# of induction variables found");
+STATISTIC(NumReduced, "# of a*i+b expressions strength reduced to induction variables");
+STATISTIC(NumUnprofitable, "# of a*i+b expressions left alone because they run too rarely");
+
 namespace{
-    struct bso_ido :  public LoopPass{
-        static char ID;
-        bso_ido() : LoopPass(ID) {};
-        int counter = 0;
+    // shared by the legacy and the new pass manager passes
+    struct bso_ido_impl{
+        ScalarEvolution &SE;
+        OptimizationRemarkEmitter &ORE;
+        bso_profile_model &profile;
+        int &counter;
+        // the triplets found in the current loop, reset for every loop
+        BumpPtrAllocator arena;
 
-        void getAnalysisUsage(AnalysisUsage &Info) const{
-            // Info.setPreservesCFG();
-            Info.addRequired<ScalarEvolutionWrapperPass>();
-        }
+        bso_ido_impl(ScalarEvolution &SE, OptimizationRemarkEmitter &ORE, bso_profile_model &profile,
+                     int &counter)
+            : SE(SE), ORE(ORE), profile(profile), counter(counter) {};
 
         struct triplet{
             // stores triplet j = a*i +b, where i is basic induction variable 
@@ -36,7 +52,8 @@ namespace{
             Value * coef_mult;
         };
 
-        bool runOnLoop(Loop * L, LPPassManager &LPM) override{
+        bool runOnLoop(Loop * L){
+            bso_phase_timer timer("bso_ido.reduce", "BSO IDO: strength reduce induction expressions");
             bool isChanged = false;
 
             PHINode* induction_var;
@@ -48,11 +65,16 @@ namespace{
             isChanged = false;
             l_blocks = L->getBlocks();
             triplet* curr_triplet;
-            ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+            arena.Reset();
 
             if (L->getLoopPreheader() != NULL){
                 loop_begin = &(*(L->getLoopPreheader()));
             }else{
+                ORE.emit([&]{
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "NoPreheader", L->getStartLoc(),
+                                                    L->getHeader())
+                        << "loop has no preheader to compute the new induction variables in";
+                });
                 return false;
             }
 
@@ -68,7 +90,9 @@ namespace{
                         const SCEV * S = SE.getSCEVAtScope(I,L);
                         const SCEVAddRecExpr * SARE = dyn_cast<SCEVAddRecExpr>(S);
                         if (SARE != NULL){
-                            errs() <<  "Found induction variable : " <<  I->getName() <<  "\n";
+                            LLVM_DEBUG(dbgs() << "bso_ido: found induction variable "
+                                              << I->getName() << "\n");
+                            ++NumInductionVars;
                             // find out how much the induction variable steps by
                             // add to induction vars if it is simple addition and subtraction by a constant
                             induction_vars.push_back(I);
@@ -95,7 +119,7 @@ namespace{
                                 L->isLoopInvariant(I->getOperand(1))) or
                                 (I->getOperand(1) == curr_induction_var and
                                 L->isLoopInvariant(I->getOperand(0)))){
-                                curr_triplet = new triplet;
+                                curr_triplet = new (arena.Allocate<triplet>()) triplet;
                                 curr_triplet->i_mult = I;
                                 curr_triplet->i_add = NULL;
                                 if (L->isLoopInvariant(I->getOperand(0))){
@@ -128,20 +152,62 @@ namespace{
 
                 // entry expression
                 Value* entry = dyn_cast<PHINode>(curr_induction_var)->getIncomingValue(0);
-                entry->dump();
                 // increment expression
                 Value* increment = dyn_cast<PHINode>(curr_induction_var)->getIncomingValue(1);
-                increment->dump();
+                LLVM_DEBUG(dbgs() << "bso_ido: entry" << *entry << ", increment" << *increment
+                                  << "\n");
                 // now go through all the triplets and pull them out of the loop
                 for (unsigned i = 0 ; i <  indvar_family.size(); i++){
                     
+                    if (indvar_family[i]->i_add == NULL){
+                        ORE.emit([&]{
+                            return OptimizationRemarkMissed(DEBUG_TYPE, "NoAddend",
+                                                            indvar_family[i]->i_mult)
+                                << "multiple of induction variable "
+                                << ore::NV("IndVar", curr_induction_var)
+                                << " is not used by a loop invariant addition";
+                        });
+                    }
+                    // the mul and the add leave the loop, an add per step of i and three
+                    // instructions in the preheader come in: not worth it in a loop
+                    // that rarely iterates or for an a*i+b on a cold path
+                    double saved = 0;
+                    if (indvar_family[i]->i_add != NULL and profile.BFI != NULL){
+                        saved = profile.getCount(indvar_family[i]->i_mult->getParent()) +
+                                profile.getCount(indvar_family[i]->i_add->getParent()) -
+                                profile.getCount(cast<Instruction>(increment)->getParent()) -
+                                3 * profile.getCount(loop_begin);
+                        if (saved <= 0){
+                            ++NumUnprofitable;
+                            profile.rejected(DEBUG_TYPE);
+                            ORE.emit([&]{
+                                return OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable",
+                                                                indvar_family[i]->i_add)
+                                    << "a*i+b on induction variable "
+                                    << ore::NV("IndVar", curr_induction_var)
+                                    << " runs too rarely to pay for a new induction variable";
+                            });
+                            continue;
+                        }
+                    }
                     // first, move the a*i + b instruction to the preheader
                     if (indvar_family[i]->i_add != NULL){
+                    profile.applied(DEBUG_TYPE, saved);
+                    ORE.emit([&]{
+                        return OptimizationRemark(DEBUG_TYPE, "StrengthReduced",
+                                                  indvar_family[i]->i_add)
+                            << "a*i+b on induction variable "
+                            << ore::NV("IndVar", curr_induction_var)
+                            << " replaced by a new induction variable stepping by a times its step";
+                    });
                     if (indvar_family[i]->i_mult->getOperand(0) == curr_induction_var){
                         indvar_family[i]->i_mult->setOperand(0, entry);
                     }else{
                         indvar_family[i]->i_mult->setOperand(1, entry);
                     }
+                    // their SCEVs were computed inside the loop
+                    SE.forgetValue(indvar_family[i]->i_mult);
+                    SE.forgetValue(indvar_family[i]->i_add);
                     indvar_family[i]->i_mult->moveBefore(loop_begin->getTerminator());
                     indvar_family[i]->i_add->moveBefore(loop_begin->getTerminator());
                     IRBuilder<> Builder1(indvar_family[i]->i_add);
@@ -173,6 +239,7 @@ namespace{
                     PN->addIncoming(new_inst, dyn_cast<PHINode>(curr_induction_var)->getIncomingBlock(1));
                     
                     isChanged = true;
+                    ++NumReduced;
                     counter++;
                     }
                 }     
@@ -183,9 +250,43 @@ namespace{
             // if both mult and add are not null
             // add it to the preheader
             // and add s = i*c right after increment of i
+            if (isChanged) SE.forgetLoop(L);
             return isChanged;
         }
     };
+
+    struct bso_ido :  public LoopPass{
+        static char ID;
+        bso_ido() : LoopPass(ID) {};
+        int counter = 0;
+
+        void getAnalysisUsage(AnalysisUsage &Info) const override{
+            Info.setPreservesCFG();
+            Info.addRequired<ScalarEvolutionWrapperPass>();
+            Info.addRequired<BlockFrequencyInfoWrapperPass>();
+            Info.addPreserved<BlockFrequencyInfoWrapperPass>();
+        }
+
+        bool runOnLoop(Loop * L, LPPassManager &LPM) override{
+            Function &F = *L->getHeader()->getParent();
+            ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+            OptimizationRemarkEmitter ORE(&F);
+            bso_profile_model profile(&getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI(), F);
+            return bso_ido_impl(SE, ORE, profile, counter).runOnLoop(L);
+        }
+    };
+}
+
+PreservedAnalyses bso_ido_pass::run(Loop &L, LoopAnalysisManager &AM,
+                                    LoopStandardAnalysisResults &AR, LPMUpdater &U){
+    Function &F = *L.getHeader()->getParent();
+    OptimizationRemarkEmitter ORE(&F);
+    // cached only, as in bso_licm_pass
+    auto &FAMP = AM.getResult<FunctionAnalysisManagerLoopProxy>(L, AR);
+    bso_profile_model profile(FAMP.getCachedResult<BlockFrequencyAnalysis>(F), F);
+    if (!bso_ido_impl(AR.SE, ORE, profile, counter).runOnLoop(&L)) return PreservedAnalyses::all();
+    // new phis and adds in existing blocks; SCEV was told what moved
+    return getLoopPassPreservedAnalyses();
 }
 
 char bso_ido::ID = 0;
@@ -0,0 +1,244 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/InlineCost.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "passes.h"
+#include "phaseTimer.h"
+#include "profileModel.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+// bso_inline: the other BSO transforms stop at calls, so small callees are
+// inlined into their callers. The call graph is walked bottom-up by SCCs: a
+// callee is finished, inlined into and cleaned up, before its callers look at
+// it, so its size is what it costs. The cost of a call site is the callee's
+// instruction count, less the call itself, a bonus per constant argument the
+// callee uses and a bonus when this call is the last use of an internal
+// callee. A caller stops taking callees once it reached -bso-inline-max-growth
+// percent of its size. Callers that took something get the cleanup passes of
+// bso-O2 right away. Recursive functions are left to bso_tre.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_inline"
+STATISTIC(NumInlined, "# of call sites inlined");
+STATISTIC(NumDeleted, "# of internal functions deleted once inlined everywhere");
+STATISTIC(NumTooCostly, "# of call sites not inlined because the callee costs too much");
+STATISTIC(NumTooMuchGrowth, "# of call sites not inlined because the caller grew too much");
+
+static cl::opt<int> Threshold("bso-inline-threshold", cl::init(45), cl::Hidden,
+        cl::desc("BSO: highest cost, in instructions, of a call site that gets inlined"));
+static cl::opt<int> ConstantArgBonus("bso-inline-constant-arg-bonus", cl::init(10), cl::Hidden,
+        cl::desc("BSO: cost taken off per constant argument the callee uses"));
+static cl::opt<int> SingleSiteBonus("bso-inline-single-site-bonus", cl::init(150), cl::Hidden,
+        cl::desc("BSO: cost taken off when the callee is internal and this is its only call"));
+static cl::opt<unsigned> MaxGrowth("bso-inline-max-growth", cl::init(300), cl::Hidden,
+        cl::desc("BSO: size, in percent of its own, a caller may grow to by inlining"));
+
+namespace{
+    struct bso_inline_impl{
+        Module &M;
+        FunctionAnalysisManager &FAM;
+        DenseMap<Function*, unsigned> sizes;
+        SmallPtrSet<Function*, 16> recursive;
+        std::vector<Function*> dead;
+
+        bso_inline_impl(Module &M, FunctionAnalysisManager &FAM) : M(M), FAM(FAM) {};
+
+        static unsigned countInstructions(Function &F){
+            unsigned n = 0;
+            for (Instruction &I : instructions(F)){
+                if (!isa<DbgInfoIntrinsic>(I)) n++;
+            }
+            return n;
+        }
+
+        // the defined functions, callees before their callers
+        std::vector<Function*> getBottomUpOrder(){
+            std::vector<Function*> order;
+            CallGraph CG(M);
+            for (scc_iterator<CallGraph*> it = scc_begin(&CG); !it.isAtEnd(); ++it){
+                for (CallGraphNode *node : *it){
+                    Function *F = node->getFunction();
+                    if (F == NULL or F->isDeclaration()) continue;
+                    order.push_back(F);
+                    if (it.hasLoop()) recursive.insert(F);
+                }
+            }
+            return order;
+        }
+
+        bool isInlinable(CallSite CS, Function *caller, Function *callee){
+            if (callee == NULL or callee->isDeclaration() or callee == caller) return false;
+            if (recursive.count(callee) or callee->isInterposable()) return false;
+            if (CS.isNoInline() or callee->hasFnAttribute(Attribute::NoInline)) return false;
+            if (CS.getFunctionType() != callee->getFunctionType()) return false;
+            if (!AttributeFuncs::areInlineCompatible(*caller, *callee)) return false;
+            if (!FAM.getResult<TargetIRAnalysis>(*caller).areInlineCompatible(caller, callee)) return false;
+            return isInlineViable(*callee);
+        }
+
+        int getCost(CallSite CS, Function *callee){
+            // the call and its arguments go away with it
+            int cost = (int)sizes.lookup(callee) - 1 - (int)CS.arg_size();
+            // uses of a constant argument mostly fold away once inlined; the extra
+            // arguments of a varargs call have no parameter to look at
+            for (unsigned i = 0; i < CS.arg_size() and i < callee->arg_size(); i++){
+                if (isa<Constant>(CS.getArgument(i)) and !(callee->arg_begin() + i)->use_empty()){
+                    cost -= ConstantArgBonus;
+                }
+            }
+            // no copy is left behind
+            if (callee->hasLocalLinkage() and callee->hasOneUse()) cost -= SingleSiteBonus;
+            return cost;
+        }
+
+        // inline what pays off into F, true when something was
+        bool inlineInto(Function &F){
+            bool isChanged = false;
+            OptimizationRemarkEmitter ORE(&F);
+            bso_profile_model profile(FAM.getCachedResult<BlockFrequencyAnalysis>(F), F);
+            unsigned size = countInstructions(F);
+            unsigned limit = std::max(size * MaxGrowth / 100, size + (unsigned)std::max(0, (int)Threshold));
+
+            // call sites found later come out of inlined code, which the
+            // frequencies know nothing about: only the first ones can be cold
+            std::deque<CallSite> worklist;
+            SmallPtrSet<Instruction*, 16> cold;
+            for (Instruction &I : instructions(F)){
+                CallSite CS(&I);
+                if (!CS or isa<IntrinsicInst>(I)) continue;
+                worklist.push_back(CS);
+                if (profile.isCold(I.getParent())) cold.insert(&I);
+            }
+
+            while (!worklist.empty()){
+                CallSite CS = worklist.front();
+                worklist.pop_front();
+                Instruction *call = CS.getInstruction();
+                Function *callee = CS.getCalledFunction();
+                bool is_cold = cold.erase(call);
+                if (!isInlinable(CS, &F, callee)) continue;
+
+                unsigned callee_size = sizes.lookup(callee);
+                if (!callee->hasFnAttribute(Attribute::AlwaysInline)){
+                    int cost = getCost(CS, callee);
+                    if (cost > Threshold){
+                        ++NumTooCostly;
+                        ORE.emit([&]{
+                            return OptimizationRemarkMissed(DEBUG_TYPE, "TooCostly", call)
+                                << ore::NV("Callee", callee) << " not inlined: cost "
+                                << ore::NV("Cost", cost) << " over "
+                                << ore::NV("Threshold", (int)Threshold);
+                        });
+                        continue;
+                    }
+                    if (size + callee_size > limit){
+                        ++NumTooMuchGrowth;
+                        ORE.emit([&]{
+                            return OptimizationRemarkMissed(DEBUG_TYPE, "TooMuchGrowth", call)
+                                << ore::NV("Callee", callee) << " not inlined: "
+                                << ore::NV("Caller", &F) << " would grow past "
+                                << ore::NV("Limit", limit) << " instructions";
+                        });
+                        continue;
+                    }
+                    // one call less is not worth a copy of the callee in cold code
+                    if (is_cold and !callee->hasOneUse()){
+                        profile.rejected(DEBUG_TYPE);
+                        continue;
+                    }
+                }
+
+                double saved = is_cold ? 0 : profile.getCount(call->getParent()) * (2 + CS.arg_size());
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "Inlined", call)
+                        << ore::NV("Callee", callee) << " inlined into " << ore::NV("Caller", &F);
+                });
+                LLVM_DEBUG(dbgs() << "bso_inline: " << callee->getName() << " into "
+                                  << F.getName() << "\n");
+                InlineFunctionInfo IFI;
+                if (!InlineFunction(CS, IFI)) continue;
+                // at least the call, the return and the argument passing
+                profile.applied(DEBUG_TYPE, saved);
+                size += callee_size;
+                for (CallSite inlined : IFI.InlinedCallSites){
+                    if (!isa<IntrinsicInst>(inlined.getInstruction())) worklist.push_back(inlined);
+                }
+                if (callee->hasLocalLinkage() and callee->use_empty() and
+                    std::find(dead.begin(), dead.end(), callee) == dead.end()){
+                    dead.push_back(callee);
+                }
+                ++NumInlined;
+                isChanged = true;
+            }
+            return isChanged;
+        }
+
+        // what the callee brought along, folded before the callers look at its size
+        void cleanup(Function &F){
+            FunctionPassManager FPM;
+            FPM.addPass(bso_cp_pass());
+            FPM.addPass(bso_alg_simplify_pass());
+            FPM.addPass(bso_jump_thread_pass());
+            FPM.addPass(bso_cse_pass());
+            FPM.addPass(bso_dse_pass());
+            FPM.addPass(bso_adce_pass());
+            FAM.invalidate(F, PreservedAnalyses::none());
+            FPM.run(F, FAM);
+        }
+
+        bool runOnModule(){
+            bool isChanged = false;
+            std::vector<Function*> order = getBottomUpOrder();
+            for (Function *F : order) sizes[F] = countInstructions(*F);
+
+            for (Function *F : order){
+                if (F->hasFnAttribute(Attribute::OptimizeNone)) continue;
+                bool inlined;
+                {
+                    bso_phase_timer timer("bso_inline.inline", "BSO inliner: inline call sites");
+                    inlined = inlineInto(*F);
+                }
+                if (!inlined) continue;
+                {
+                    bso_phase_timer timer("bso_inline.cleanup", "BSO inliner: clean up callers");
+                    cleanup(*F);
+                }
+                sizes[F] = countInstructions(*F);
+                isChanged = true;
+            }
+
+            for (Function *F : dead){
+                if (!F->use_empty()) continue;
+                FAM.invalidate(*F, PreservedAnalyses::none());
+                F->eraseFromParent();
+                ++NumDeleted;
+            }
+            return isChanged;
+        }
+    };
+}
+
+PreservedAnalyses bso_inline_pass::run(Module &M, ModuleAnalysisManager &AM){
+    FunctionAnalysisManager &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    bso_inline_impl impl(M, FAM);
+    if (!impl.runOnModule()) return PreservedAnalyses::all();
+    return PreservedAnalyses::none();
+}
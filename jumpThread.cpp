@@ -0,0 +1,342 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "passes.h"
+#include "phaseTimer.h"
+#include "profileModel.h"
+
+#include <algorithm>
+#include <vector>
+
+// jump threading: when a predecessor decides which way a block's branch goes,
+// e.g. the condition is a phi of constants or a compare the predecessor's own
+// branch settles, the block is duplicated for that predecessor with a jump to
+// the successor the branch would take. Branches a dominating condition already
+// decides are folded in place. Loop headers are never duplicated nor jumped to
+// from a copy, so every loop keeps its preheader, header and latches.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_jump_thread"
+STATISTIC(NumThreaded, "# of edges threaded past a branch");
+STATISTIC(NumImplied, "# of branches folded by a dominating condition");
+STATISTIC(NumTooBig, "# of threadable edges left alone because the block is too big");
+
+static cl::opt<unsigned> Threshold("bso-jump-thread-threshold", cl::init(6), cl::Hidden,
+        cl::desc("BSO: largest block, in instructions, jump threading duplicates"));
+
+// dominators looked at for a condition deciding a branch
+static const unsigned MaxDominatorDepth = 8;
+
+namespace{
+    // shared by the legacy and the new pass manager passes
+    struct bso_jump_thread_impl{
+        DominatorTree &DT;
+        LoopInfo &LI;
+        OptimizationRemarkEmitter &ORE;
+        bso_profile_model &profile;
+        const DataLayout &DL;
+        SmallPtrSet<BasicBlock*, 16> copies;    // the profile knows nothing about them
+
+        bso_jump_thread_impl(DominatorTree &DT, LoopInfo &LI, OptimizationRemarkEmitter &ORE,
+                             bso_profile_model &profile, const DataLayout &DL)
+            : DT(DT), LI(LI), ORE(ORE), profile(profile), DL(DL) {};
+
+        Value *getCondition(TerminatorInst *T){
+            if (BranchInst *BI = dyn_cast<BranchInst>(T)){
+                return BI->isConditional() ? BI->getCondition() : NULL;
+            }
+            if (SwitchInst *SI = dyn_cast<SwitchInst>(T)) return SI->getCondition();
+            return NULL;
+        }
+
+        // the successor T takes when its condition is C
+        BasicBlock *getTarget(TerminatorInst *T, Constant *C){
+            ConstantInt *CI = dyn_cast<ConstantInt>(C);
+            if (CI == NULL) return NULL;
+            if (BranchInst *BI = dyn_cast<BranchInst>(T)){
+                return BI->getSuccessor(CI->isZero() ? 1 : 0);
+            }
+            return cast<SwitchInst>(T)->findCaseValue(CI)->getCaseSuccessor();
+        }
+
+        // ---- branches decided by a dominating condition ----
+
+        Optional<bool> getImpliedByDominator(BasicBlock *BB, Value *cond){
+            DomTreeNode *node = DT.getNode(BB);
+            for (unsigned depth = 0; node != NULL and depth < MaxDominatorDepth; depth++){
+                node = node->getIDom();
+                if (node == NULL) break;
+                BranchInst *DBI = dyn_cast<BranchInst>(node->getBlock()->getTerminator());
+                if (DBI == NULL or !DBI->isConditional() or
+                    DBI->getSuccessor(0) == DBI->getSuccessor(1)){
+                    continue;
+                }
+                for (unsigned s = 0; s < 2; s++){
+                    BasicBlockEdge edge(node->getBlock(), DBI->getSuccessor(s));
+                    if (!DT.dominates(edge, BB)) continue;
+                    Optional<bool> implied = isImpliedCondition(DBI->getCondition(), cond, DL, s == 0);
+                    if (implied) return implied;
+                }
+            }
+            return None;
+        }
+
+        // dominance only grows as edges go, so the tree stays good enough for this
+        bool foldImpliedBranches(Function &F){
+            bool isChanged = false;
+            for (BasicBlock &BB : F){
+                BranchInst *BI = dyn_cast<BranchInst>(BB.getTerminator());
+                if (BI == NULL or !BI->isConditional() or !isa<CmpInst>(BI->getCondition())) continue;
+                Optional<bool> implied = getImpliedByDominator(&BB, BI->getCondition());
+                if (!implied) continue;
+                BasicBlock *taken = BI->getSuccessor(*implied ? 0 : 1);
+                BasicBlock *dead = BI->getSuccessor(*implied ? 1 : 0);
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "ImpliedBranch", BI)
+                        << "branch folded: a dominating condition decides it";
+                });
+                if (dead != taken) dead->removePredecessor(&BB);
+                BranchInst::Create(taken, BI);
+                BI->eraseFromParent();
+                ++NumImplied;
+                isChanged = true;
+            }
+            return isChanged;
+        }
+
+        // ---- threading ----
+
+        // V's value when BB is entered from pred, NULL when it is not a constant
+        Constant *evaluateOnEdge(Value *V, BasicBlock *BB, BasicBlock *pred){
+            if (Constant *C = dyn_cast<Constant>(V)) return C;
+            Instruction *I = dyn_cast<Instruction>(V);
+            if (I == NULL or I->getParent() != BB) return NULL;
+            if (PHINode *PN = dyn_cast<PHINode>(I)){
+                return dyn_cast<Constant>(PN->getIncomingValueForBlock(pred));
+            }
+            CmpInst *CI = dyn_cast<CmpInst>(I);
+            if (CI == NULL) return NULL;
+            Constant *lhs = evaluateOnEdge(CI->getOperand(0), BB, pred);
+            Constant *rhs = evaluateOnEdge(CI->getOperand(1), BB, pred);
+            if (lhs == NULL or rhs == NULL) return NULL;
+            return ConstantFoldCompareInstOperands(CI->getPredicate(), lhs, rhs, DL);
+        }
+
+        // where BB's terminator goes when entered from pred, NULL when unknown
+        BasicBlock *getThreadTarget(BasicBlock *BB, BasicBlock *pred){
+            TerminatorInst *T = BB->getTerminator();
+            Value *cond = getCondition(T);
+            if (cond == NULL) return NULL;
+            if (Constant *C = evaluateOnEdge(cond, BB, pred)) return getTarget(T, C);
+
+            // pred's own branch may settle a compare; not one on BB's phis, whose
+            // values differ from what pred's branch saw when pred is a latch
+            CmpInst *CI = dyn_cast<CmpInst>(cond);
+            BranchInst *PBI = dyn_cast<BranchInst>(pred->getTerminator());
+            if (CI == NULL or !isa<BranchInst>(T) or PBI == NULL or !PBI->isConditional() or
+                PBI->getSuccessor(0) == PBI->getSuccessor(1)){
+                return NULL;
+            }
+            for (Value *op : CI->operands()){
+                PHINode *PN = dyn_cast<PHINode>(op);
+                if (PN != NULL and PN->getParent() == BB) return NULL;
+            }
+            Optional<bool> implied = isImpliedCondition(PBI->getCondition(), CI, DL,
+                                                        PBI->getSuccessor(0) == BB);
+            if (!implied) return NULL;
+            return cast<BranchInst>(T)->getSuccessor(*implied ? 0 : 1);
+        }
+
+        // non-phi instructions a copy of BB costs, ~0u when BB cannot be copied
+        unsigned getDuplicationCost(BasicBlock *BB){
+            unsigned cost = 0;
+            for (Instruction &I : *BB){
+                if (isa<PHINode>(I) or isa<DbgInfoIntrinsic>(I) or I.isTerminator()) continue;
+                if (I.getType()->isTokenTy()) return ~0u;
+                if (CallInst *CI = dyn_cast<CallInst>(&I)){
+                    if (CI->cannotDuplicate() or CI->isConvergent()) return ~0u;
+                }
+                cost++;
+            }
+            return cost;
+        }
+
+        bool isThreadable(BasicBlock *BB, BasicBlock *pred, BasicBlock *target){
+            if (pred == BB or target == BB) return false;
+            // a new edge into a header would be a second entry or latch
+            if (LI.isLoopHeader(BB) or LI.isLoopHeader(target)) return false;
+            TerminatorInst *PT = pred->getTerminator();
+            if (!isa<BranchInst>(PT) and !isa<SwitchInst>(PT)) return false;
+            unsigned edges = 0;
+            for (BasicBlock *succ : successors(pred)) edges += succ == BB;
+            return edges == 1;
+        }
+
+        // give pred a copy of BB that jumps straight to target
+        void thread(BasicBlock *BB, BasicBlock *pred, BasicBlock *target){
+            LLVM_DEBUG(dbgs() << "bso_jump_thread: " << pred->getName() << " -> "
+                              << BB->getName() << " -> " << target->getName() << "\n");
+            Function *F = BB->getParent();
+            BasicBlock *copy = BasicBlock::Create(BB->getContext(), BB->getName() + ".thread",
+                                                  F, BB->getNextNode());
+            ValueToValueMapTy VMap;
+            for (Instruction &I : *BB){
+                if (PHINode *PN = dyn_cast<PHINode>(&I)){
+                    VMap[PN] = PN->getIncomingValueForBlock(pred);
+                    continue;
+                }
+                if (I.isTerminator()) break;
+                Instruction *New = I.clone();
+                if (I.hasName()) New->setName(I.getName());
+                copy->getInstList().push_back(New);
+                VMap[&I] = New;
+                RemapInstruction(New, VMap, RF_IgnoreMissingLocals | RF_NoModuleLevelChanges);
+            }
+            BranchInst::Create(target, copy);
+            copies.insert(copy);
+            if (Loop *L = LI.getLoopFor(BB)) L->addBasicBlockToLoop(copy, LI);
+
+            pred->getTerminator()->replaceUsesOfWith(BB, copy);
+            BB->removePredecessor(pred, true);
+            for (Instruction &I : *target){
+                PHINode *PN = dyn_cast<PHINode>(&I);
+                if (PN == NULL) break;
+                Value *V = PN->getIncomingValueForBlock(BB);
+                auto it = VMap.find(V);
+                PN->addIncoming(it != VMap.end() ? (Value*)it->second : V, copy);
+            }
+
+            // what BB defines now has a second definition in the copy
+            SSAUpdater SSA;
+            for (Instruction &I : *BB){
+                std::vector<Use*> uses;
+                for (Use &U : I.uses()){
+                    Instruction *user = cast<Instruction>(U.getUser());
+                    BasicBlock *at = user->getParent();
+                    if (PHINode *PN = dyn_cast<PHINode>(user)) at = PN->getIncomingBlock(U);
+                    if (at != BB) uses.push_back(&U);
+                }
+                if (uses.empty()) continue;
+                SSA.Initialize(I.getType(), I.getName());
+                SSA.AddAvailableValue(BB, &I);
+                SSA.AddAvailableValue(copy, VMap[&I]);
+                for (Use *U : uses) SSA.RewriteUse(*U);
+            }
+        }
+
+        bool threadBlock(BasicBlock *BB){
+            bool isChanged = false;
+            if (getCondition(BB->getTerminator()) == NULL or BB->hasAddressTaken() or
+                BB->isEHPad()){
+                return false;
+            }
+            unsigned cost = getDuplicationCost(BB);
+            std::vector<BasicBlock*> preds(pred_begin(BB), pred_end(BB));
+            for (BasicBlock *pred : preds){
+                BasicBlock *target = getThreadTarget(BB, pred);
+                if (target == NULL or !isThreadable(BB, pred, target)) continue;
+                if (cost > Threshold){
+                    ++NumTooBig;
+                    ORE.emit([&]{
+                        return OptimizationRemarkMissed(DEBUG_TYPE, "TooBig", BB->getTerminator())
+                            << "not threaded from " << ore::NV("Pred", pred->getName())
+                            << ": the block has " << ore::NV("Cost", cost)
+                            << " instructions to duplicate";
+                    });
+                    continue;
+                }
+                // code duplicated for a cold edge is code size for nothing
+                if (!copies.count(pred) and profile.isCold(pred)){
+                    profile.rejected(DEBUG_TYPE);
+                    continue;
+                }
+                double saved = copies.count(pred) ? 0 : std::min(profile.getCount(pred),
+                                                                profile.getCount(BB));
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "Threaded", BB->getTerminator())
+                        << "threaded the edge from " << ore::NV("Pred", pred->getName()) << " to "
+                        << ore::NV("Target", target->getName()) << ": its branch outcome is known there";
+                });
+                thread(BB, pred, target);
+                profile.applied(DEBUG_TYPE, saved);
+                ++NumThreaded;
+                isChanged = true;
+            }
+            // every predecessor went its own way
+            if (isChanged and pred_empty(BB)){
+                LI.removeBlock(BB);
+                DeleteDeadBlock(BB);
+            }
+            return isChanged;
+        }
+
+        bool runOnFunction(Function &F){
+            bool isChanged = false;
+            {
+                bso_phase_timer timer("bso_jump_thread.implied", "BSO jump threading: implied branches");
+                isChanged |= foldImpliedBranches(F);
+            }
+            bso_phase_timer timer("bso_jump_thread.thread", "BSO jump threading: thread edges");
+            std::vector<BasicBlock*> blocks;
+            for (BasicBlock &BB : F) blocks.push_back(&BB);
+            for (BasicBlock *BB : blocks) isChanged |= threadBlock(BB);
+            return isChanged;
+        }
+    };
+
+    struct bso_jump_thread : public FunctionPass{
+        static char ID;
+        bso_jump_thread() : FunctionPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+        }
+
+        bool runOnFunction(Function &F) override{
+            auto *BFIP = getAnalysisIfAvailable<BlockFrequencyInfoWrapperPass>();
+            bso_profile_model profile(BFIP != NULL ? &BFIP->getBFI() : NULL, F);
+            bso_jump_thread_impl impl(getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+                                      getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                                      getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE(),
+                                      profile, F.getParent()->getDataLayout());
+            return impl.runOnFunction(F);
+        }
+    };
+}
+
+PreservedAnalyses bso_jump_thread_pass::run(Function &F, FunctionAnalysisManager &AM){
+    // the frequencies only if someone computed them, they are not worth a run of their own
+    bso_profile_model profile(AM.getCachedResult<BlockFrequencyAnalysis>(F), F);
+    bso_jump_thread_impl impl(AM.getResult<DominatorTreeAnalysis>(F),
+                              AM.getResult<LoopAnalysis>(F),
+                              AM.getResult<OptimizationRemarkEmitterAnalysis>(F),
+                              profile, F.getParent()->getDataLayout());
+    if (!impl.runOnFunction(F)) return PreservedAnalyses::all();
+    return PreservedAnalyses::none();
+}
+
+std::string bso_jump_thread_pass::options(){
+    return "bso-jump-thread-threshold=" + std::to_string(Threshold);
+}
+
+char bso_jump_thread::ID = 0;
+static RegisterPass<bso_jump_thread> J("bso_jump_thread", "BSO: Jump Threading");
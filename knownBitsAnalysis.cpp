@@ -0,0 +1,219 @@
+#include "knownBitsAnalysis.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+// how far getKnownBits follows operands before giving up
+static const unsigned MaxDepth = 6;
+
+void bso_known_bits_info::forgetValue(Value *V){
+    cache.erase(V);
+}
+
+known_bits bso_known_bits_info::getKnownBits(Value *V){
+    return compute(V, 0);
+}
+
+known_bits bso_known_bits_info::compute(Value *V, unsigned depth){
+    unsigned width = V->getType()->getIntegerBitWidth();
+    known_bits res = {APInt(width, 0), APInt(width, 0)};
+
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(V)){
+        res.one = CI->getValue();
+        res.zero = ~CI->getValue();
+        return res;
+    }
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (I == NULL) return res;
+
+    auto found = cache.find(V);
+    if (found != cache.end()) return found->second;
+    if (depth > MaxDepth or in_progress.count(V)) return res;
+
+    in_progress.insert(V);
+    res = computeInst(I, depth);
+    in_progress.erase(V);
+    cache.insert(std::make_pair(V, res));
+    return res;
+}
+
+known_bits bso_known_bits_info::computeInst(Instruction *I, unsigned depth){
+    unsigned width = I->getType()->getIntegerBitWidth();
+    known_bits res = {APInt(width, 0), APInt(width, 0)};
+    known_bits lhs = res, rhs = res;
+    ConstantInt *amount = NULL;
+    ConstantInt *shift = NULL;
+
+    if (isa<BinaryOperator>(I)){
+        lhs = compute(I->getOperand(0), depth + 1);
+        rhs = compute(I->getOperand(1), depth + 1);
+        amount = dyn_cast<ConstantInt>(I->getOperand(1));
+        // shifting by the width or more is poison, nothing to learn
+        if (amount != NULL and amount->getValue().ult(width)) shift = amount;
+    }
+
+    switch (I->getOpcode()){
+        case Instruction::And:
+            res.zero = lhs.zero | rhs.zero;
+            res.one = lhs.one & rhs.one;
+            break;
+        case Instruction::Or:
+            res.zero = lhs.zero & rhs.zero;
+            res.one = lhs.one | rhs.one;
+            break;
+        case Instruction::Xor:
+            res.zero = (lhs.zero & rhs.zero) | (lhs.one & rhs.one);
+            res.one = (lhs.zero & rhs.one) | (lhs.one & rhs.zero);
+            break;
+        case Instruction::Shl:
+            if (shift != NULL){
+                unsigned c = shift->getZExtValue();
+                res.zero = lhs.zero.shl(c);
+                res.zero.setLowBits(c);
+                res.one = lhs.one.shl(c);
+            }
+            break;
+        case Instruction::LShr:
+            if (shift != NULL){
+                unsigned c = shift->getZExtValue();
+                res.zero = lhs.zero.lshr(c);
+                res.zero.setHighBits(c);
+                res.one = lhs.one.lshr(c);
+            }
+            break;
+        case Instruction::AShr:
+            if (shift != NULL){
+                unsigned c = shift->getZExtValue();
+                res.zero = lhs.zero.ashr(c);
+                res.one = lhs.one.ashr(c);
+            }
+            break;
+        case Instruction::Add:
+        case Instruction::Sub:{
+            if (lhs.isConstant() and rhs.isConstant()){
+                res.one = I->getOpcode() == Instruction::Add ? lhs.one + rhs.one : lhs.one - rhs.one;
+                res.zero = ~res.one;
+                break;
+            }
+            // trailing zeros of both sides stay zero
+            unsigned tz = std::min(lhs.zero.countTrailingOnes(), rhs.zero.countTrailingOnes());
+            res.zero.setLowBits(tz);
+            break;
+        }
+        case Instruction::Mul:{
+            unsigned tz = lhs.zero.countTrailingOnes() + rhs.zero.countTrailingOnes();
+            res.zero.setLowBits(std::min(tz, width));
+            break;
+        }
+        case Instruction::URem:
+            // x urem 2^k keeps the low k bits of x
+            if (amount != NULL and amount->getValue().isPowerOf2()){
+                APInt mask = APInt::getLowBitsSet(width, amount->getValue().logBase2());
+                res.zero = lhs.zero | ~mask;
+                res.one = lhs.one & mask;
+            }
+            break;
+        case Instruction::ZExt:{
+            known_bits src = compute(I->getOperand(0), depth + 1);
+            res.zero = src.zero.zext(width);
+            res.zero.setHighBits(width - src.zero.getBitWidth());
+            res.one = src.one.zext(width);
+            break;
+        }
+        case Instruction::SExt:{
+            // the copies of the sign bit are known if the sign bit is
+            known_bits src = compute(I->getOperand(0), depth + 1);
+            res.zero = src.zero.sext(width);
+            res.one = src.one.sext(width);
+            break;
+        }
+        case Instruction::Trunc:{
+            known_bits src = compute(I->getOperand(0), depth + 1);
+            res.zero = src.zero.trunc(width);
+            res.one = src.one.trunc(width);
+            break;
+        }
+        case Instruction::Select:{
+            known_bits t = compute(I->getOperand(1), depth + 1);
+            known_bits f = compute(I->getOperand(2), depth + 1);
+            res.zero = t.zero & f.zero;
+            res.one = t.one & f.one;
+            break;
+        }
+        case Instruction::PHI:{
+            // only what every incoming value agrees on
+            PHINode *PN = cast<PHINode>(I);
+            res.zero.setAllBits();
+            res.one.setAllBits();
+            for (unsigned i = 0; i < PN->getNumIncomingValues(); i++){
+                known_bits in = compute(PN->getIncomingValue(i), depth + 1);
+                res.zero &= in.zero;
+                res.one &= in.one;
+                if (res.zero == 0 and res.one == 0) break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return res;
+}
+
+void bso_known_bits_info::print(raw_ostream &O){
+    for (inst_iterator I = inst_begin(curr_func), E = inst_end(curr_func); I != E; ++I){
+        if (!I->getType()->isIntegerTy() or !I->hasName()) continue;
+        known_bits kb = getKnownBits(&*I);
+        O << I->getName() << " : ";
+        for (unsigned i = kb.zero.getBitWidth(); i > 0; i--){
+            if (kb.zero[i-1]){
+                O << "0";
+            }else if (kb.one[i-1]){
+                O << "1";
+            }else{
+                O << "?";
+            }
+        }
+        O << "\n";
+    }
+}
+
+// ---- new pass manager ----
+
+AnalysisKey bso_known_bits_analysis::Key;
+
+bso_known_bits_info bso_known_bits_analysis::run(Function &F, FunctionAnalysisManager &AM){
+    // nothing is computed up front, clients ask for the values they care about
+    return bso_known_bits_info(F);
+}
+
+PreservedAnalyses bso_known_bits_printer_pass::run(Function &F, FunctionAnalysisManager &AM){
+    AM.getResult<bso_known_bits_analysis>(F).print(errs());
+    return PreservedAnalyses::all();
+}
+
+// ---- legacy pass manager ----
+
+void bso_known_bits_wrapper::getAnalysisUsage(AnalysisUsage &AU) const{
+    AU.setPreservesAll();
+}
+
+bool bso_known_bits_wrapper::runOnFunction(Function &F){
+    info.reset(new bso_known_bits_info(F));
+    return false;
+}
+
+void bso_known_bits_wrapper::releaseMemory(){
+    info.reset();
+}
+
+void bso_known_bits_wrapper::print(raw_ostream &O, const Module *M) const{
+    if (info) info->print(O);
+}
+
+char bso_known_bits_wrapper::ID = 0;
+static RegisterPass<bso_known_bits_wrapper> K("bso_known_bits_analysis",
+                                              "BSO: Known Bits Analysis", false, true);
@@ -0,0 +1,72 @@
+// Goal : Bit level facts about integer values: for every value, which bits are
+// known to be zero and which are known to be one. Computed on demand, memoized,
+// and cut off at a fixed depth so long chains do not blow up.
+
+#ifndef BSO_KNOWN_BITS_ANALYSIS_H
+#define BSO_KNOWN_BITS_ANALYSIS_H
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/APInt.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Value.h"
+#include <map>
+#include <memory>
+#include <set>
+
+struct known_bits{
+    llvm::APInt zero;       // bits known to be 0
+    llvm::APInt one;        // bits known to be 1
+
+    // every bit of the value is known, i.e. it is a constant
+    bool isConstant() const { return (zero | one).isAllOnesValue(); }
+};
+
+// the analysis result, shared by both pass managers
+struct bso_known_bits_info{
+    bso_known_bits_info(llvm::Function &F) : curr_func(&F) {};
+
+    // known bits of the integer value V
+    known_bits getKnownBits(llvm::Value *V);
+
+    // drop the memoized bits of V; clients call this before erasing V
+    void forgetValue(llvm::Value *V);
+
+    void print(llvm::raw_ostream &O);
+
+private:
+    llvm::Function *curr_func;
+    std::map<llvm::Value*, known_bits> cache;
+    std::set<llvm::Value*> in_progress;     // breaks cycles through phis
+
+    known_bits compute(llvm::Value *V, unsigned depth);
+    known_bits computeInst(llvm::Instruction *I, unsigned depth);
+};
+
+// new pass manager analysis
+struct bso_known_bits_analysis : public llvm::AnalysisInfoMixin<bso_known_bits_analysis>{
+    typedef bso_known_bits_info Result;
+    bso_known_bits_info run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    static llvm::AnalysisKey Key;
+};
+
+struct bso_known_bits_printer_pass : public llvm::PassInfoMixin<bso_known_bits_printer_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// legacy pass manager wrapper
+struct bso_known_bits_wrapper : public llvm::FunctionPass{
+    static char ID;
+    bso_known_bits_wrapper() : llvm::FunctionPass(ID) {};
+
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+    bool runOnFunction(llvm::Function &F) override;
+    void releaseMemory() override;
+    void print(llvm::raw_ostream &O, const llvm::Module *M) const override;
+
+    bso_known_bits_info &getInfo() { return *info; }
+
+private:
+    std::unique_ptr<bso_known_bits_info> info;
+};
+
+#endif
@@ -1,28 +1,47 @@
 #include "llvm/Pass.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/LoopInfo.h" // analysis for loops
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "passes.h"
+#include "phaseTimer.h"
+#include "profileModel.h"
 
 #include <vector>
 // find invariant code
 // NOTE: need to make it work for nested loops
 using namespace llvm;
 
+#define DEBUG_TYPE "bso_licm"
+STATISTIC(NumHoisted, "# of instructions hoisted to the preheader");
+STATISTIC(NumNoPreheader, "# of loops skipped for lack of a preheader");
+STATISTIC(NumColder, "# of invariant instructions left in blocks colder than the preheader");
+
 namespace{
-    struct bso_licm :  public LoopPass{
-        static char ID;
-        bso_licm() : LoopPass(ID) {};
+    // shared by the legacy and the new pass manager passes
+    struct bso_licm_impl{
+        OptimizationRemarkEmitter &ORE;
+        bso_profile_model &profile;
 
-        bool runOnLoop(Loop * L, LPPassManager &LPM) override{
-            // get all instructions inside a loop llvm
-            L->dump();
+        bso_licm_impl(OptimizationRemarkEmitter &ORE, bso_profile_model &profile)
+            : ORE(ORE), profile(profile) {};
+
+        bool runOnLoop(Loop * L){
+            bso_phase_timer timer("bso_licm.hoist", "BSO LICM: hoist invariant code");
+            LLVM_DEBUG(dbgs() << "bso_licm: "; L->print(dbgs()));
             
             // set invariant code to be null set
             std::vector<Instruction*> invariant_set;
             std::vector<Instruction*> inloop_defs;
             std::vector<BasicBlock* > l_blocks;
+            // rejected as colder once, the later sweeps see them again
+            SmallPtrSet<Instruction*, 8> colder;
             bool is_invariant_changed;
             bool is_invariant_expr;
             bool isChanged;
@@ -35,13 +54,19 @@ namespace{
             if (L->getLoopPreheader() != NULL){
                 Loop_begin = &(*(L->getLoopPreheader()));
             }else{
+                ++NumNoPreheader;
+                ORE.emit([&]{
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "NoPreheader", L->getStartLoc(),
+                                                    L->getHeader())
+                        << "loop has no preheader to hoist into, run loop-simplify first";
+                });
                 return false; // NOTE : look into loop simplify
             }
             do{
                 is_invariant_changed =false;       
                 inloop_defs.clear();      
                 for (auto BB : l_blocks){
-                    errs() << BB->getName() << "\n" ;
+                    LLVM_DEBUG(dbgs() << "bso_licm: block " << BB->getName() << "\n");
                     for (BasicBlock::iterator DI = BB->begin(); DI != BB->end(); ){
                         Instruction *I = &(*DI++);
                      
@@ -79,13 +104,40 @@ namespace{
                             }
                         }
                         
+                        // a block that runs less often than the preheader, e.g. in a loop
+                        // that mostly runs no iteration, would pay for the hoist
+                        if (is_invariant_expr and !I->isTerminator() and
+                            profile.getCount(BB) < profile.getCount(Loop_begin)){
+                            if (colder.insert(I).second){
+                                ++NumColder;
+                                profile.rejected(DEBUG_TYPE);
+                                ORE.emit([&]{
+                                    return OptimizationRemarkMissed(DEBUG_TYPE, "ColderThanPreheader", I)
+                                        << "not hoisted: its block runs "
+                                        << ore::NV("BlockCount", (long long)profile.getCount(BB))
+                                        << " times, the preheader "
+                                        << ore::NV("PreheaderCount", (long long)profile.getCount(Loop_begin));
+                                });
+                            }
+                            is_invariant_expr = false;
+                        }
                         if (is_invariant_expr){
                             //remove from body
                             if (!(I->isTerminator())){
-                                Loop_begin->getTerminator()->dump();
+                                double saved = profile.getCount(BB) - profile.getCount(Loop_begin);
+                                profile.applied(DEBUG_TYPE, saved);
+                                LLVM_DEBUG(dbgs() << "bso_licm: hoisting" << *I << "\n");
+                                ORE.emit([&]{
+                                    return OptimizationRemark(DEBUG_TYPE, "Hoisted", I)
+                                        << "hoisted to the preheader "
+                                        << ore::NV("Preheader", Loop_begin)
+                                        << ": every operand is loop invariant (saves about "
+                                        << ore::NV("Savings", (long long)saved) << " executions)";
+                                });
                                 I->moveBefore(Loop_begin->getTerminator());
                             
                                 invariant_set.push_back(I);
+                                ++NumHoisted;
                                 is_invariant_changed = true;
                                 isChanged = true;
                             }
@@ -101,6 +153,40 @@ namespace{
             return isChanged;
         }
     };
+
+    struct bso_licm :  public LoopPass{
+        static char ID;
+        bso_licm() : LoopPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &Info) const override{
+            // instructions only move, the block frequencies stay valid
+            Info.setPreservesCFG();
+            Info.addRequired<BlockFrequencyInfoWrapperPass>();
+            Info.addPreserved<BlockFrequencyInfoWrapperPass>();
+        }
+
+        bool runOnLoop(Loop * L, LPPassManager &LPM) override{
+            Function &F = *L->getHeader()->getParent();
+            OptimizationRemarkEmitter ORE(&F);
+            bso_profile_model profile(&getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI(), F);
+            return bso_licm_impl(ORE, profile).runOnLoop(L);
+        }
+    };
+}
+
+PreservedAnalyses bso_licm_pass::run(Loop &L, LoopAnalysisManager &AM,
+                                     LoopStandardAnalysisResults &AR, LPMUpdater &U){
+    // loop passes may only use cached function analyses, build the emitter here
+    // like the legacy pass does
+    Function &F = *L.getHeader()->getParent();
+    OptimizationRemarkEmitter ORE(&F);
+    // without block frequencies computed ahead (require<block-freq>, bso-O2 does)
+    // every block counts as hot
+    auto &FAMP = AM.getResult<FunctionAnalysisManagerLoopProxy>(L, AR);
+    bso_profile_model profile(FAMP.getCachedResult<BlockFrequencyAnalysis>(F), F);
+    if (!bso_licm_impl(ORE, profile).runOnLoop(&L)) return PreservedAnalyses::all();
+    // instructions only move to the preheader, their values stay the same
+    return getLoopPassPreservedAnalyses();
 }
 
 char bso_licm::ID = 0;
@@ -0,0 +1,77 @@
+// Goal : Iterative liveness analysis. For each BB, the variables live on entry
+// (in[B]) and on exit (out[B]), as bit vectors indexed through value_mapper.
+// Blocks are numbered in function order and every per block array is indexed
+// by that number.
+
+#ifndef BSO_LIVENESS_ANALYSIS_H
+#define BSO_LIVENESS_ANALYSIS_H
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/PassManager.h"
+#include <memory>
+#include <vector>
+
+// the analysis result, shared by both pass managers
+struct bso_liveness_info{
+    struct bb_info{
+        llvm::BasicBlock* BB;
+        std::vector<bool> uses;
+        std::vector<bool> defs;
+    };
+
+    std::vector<std::vector<bool> > in;       // in[B]
+    std::vector<std::vector<bool> > out;      // out[B]
+    llvm::DenseMap<llvm::Value*, unsigned> value_mapper;  // maps a value to the index on in the bit vector
+    std::vector<llvm::Value*> values;         // and back
+    llvm::DenseMap<llvm::BasicBlock*, unsigned> block_mapper;
+    std::vector<bb_info> blocks;
+
+    bso_liveness_info() {};
+    bso_liveness_info(bso_liveness_info &&other) = default;
+    bso_liveness_info &operator=(bso_liveness_info &&other) = default;
+
+    // compute() starts over, so one result can be reused from function to function
+    void compute(llvm::Function &F);
+    void reset();
+    void printUseDefs(llvm::raw_ostream &O);
+    void print(llvm::raw_ostream &O, llvm::Function &F);
+
+private:
+    unsigned getVar(llvm::Value *v);
+    std::vector<bool> meet(const std::vector<llvm::BasicBlock*> &bb_set,
+                           const std::vector<std::vector<bool> > &mymap);
+    std::vector<bool> xfer_fn(llvm::BasicBlock* B, const std::vector<bool> &x);
+    void printBitVector(llvm::raw_ostream &O, const std::vector<bool> &v);
+};
+
+// new pass manager analysis
+struct bso_liveness_analysis : public llvm::AnalysisInfoMixin<bso_liveness_analysis>{
+    typedef bso_liveness_info Result;
+    bso_liveness_info run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    static llvm::AnalysisKey Key;
+};
+
+struct bso_liveness_printer_pass : public llvm::PassInfoMixin<bso_liveness_printer_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// legacy pass manager wrapper, prints the result with opt -analyze
+struct bso_liveness_wrapper : public llvm::FunctionPass{
+    static char ID;
+    bso_liveness_wrapper() : llvm::FunctionPass(ID) {};
+
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+    bool runOnFunction(llvm::Function &F) override;
+    void releaseMemory() override;
+    void print(llvm::raw_ostream &O, const llvm::Module *M) const override;
+
+    bso_liveness_info &getInfo() { return *info; }
+
+private:
+    std::unique_ptr<bso_liveness_info> info;
+    llvm::Function *F = nullptr;
+};
+
+#endif
@@ -0,0 +1,680 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Analysis/LoopInfo.h" // analysis for loops
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils.h"
+#include "passes.h"
+#include "phaseTimer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+// interchange and tile perfectly nested affine loops for cache locality.
+// Loops are interchanged by trading their iteration spaces (start, step, exit
+// test) and swapping the uses of their induction variables in the body, which
+// leaves the CFG alone. The innermost loop is then tiled when one sweep of it
+// touches more memory than fits in the cache.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_loop_nest"
+STATISTIC(NumInterchanged, "# of loop pairs interchanged");
+STATISTIC(NumTiled, "# of loops tiled");
+
+static cl::opt<unsigned> CacheSize("bso-cache-size", cl::init(32768), cl::Hidden,
+        cl::desc("BSO: cache size in bytes the loop nest working set should fit in"));
+static cl::opt<unsigned> CacheLine("bso-cache-line", cl::init(64), cl::Hidden,
+        cl::desc("BSO: cache line size in bytes"));
+static cl::opt<unsigned> TileSize("bso-tile-size", cl::init(0), cl::Hidden,
+        cl::desc("BSO: force the tile size (0 = derive it from the cache size)"));
+
+namespace{
+    // shared by the legacy and the new pass manager passes
+    struct bso_loop_nest_impl{
+        OptimizationRemarkEmitter &ORE;
+        bool is_cfg_change = false;     // a loop got tiled
+
+        bso_loop_nest_impl(OptimizationRemarkEmitter &ORE) : ORE(ORE) {};
+
+        // report why the nest starting at L stays as it is; returns false for the bail-outs
+        bool missed(Loop *L, StringRef name, StringRef reason){
+            ORE.emit([&]{
+                return OptimizationRemarkMissed(DEBUG_TYPE, name, L->getStartLoc(), L->getHeader())
+                    << "loop nest not transformed: " << reason;
+            });
+            return false;
+        }
+
+        // the iteration space of a loop: i = start; do { ... } while (i+step <pred> bound)
+        struct space{
+            unsigned orig;          // index of the loop this space belonged to originally
+            Value *start;
+            Value *step;
+            Value *bound;
+            CmpInst::Predicate pred;
+            bool cmp_on_next;       // tests i+step rather than i
+            bool cont_on_true;      // the latch branch stays in the loop on true
+            bool nsw, nuw;
+        };
+
+        // the instructions controlling one loop of the nest
+        struct loop_ctrl{
+            Loop *L;
+            PHINode *iv;
+            BinaryOperator *next;
+            unsigned step_idx;      // operand of next holding the step
+            ICmpInst *cmp;
+            BranchInst *br;
+            space sp;
+        };
+
+        // a load or store in the innermost body
+        struct mem_access{
+            Instruction *I;
+            const SCEV *ptr_scev;
+            uint64_t size;
+            bool is_store;
+        };
+
+        Loop *outermost;
+
+        bool isNestInvariant(Value *V){
+            Instruction *I = dyn_cast<Instruction>(V);
+            return I == NULL or !outermost->contains(I);
+        }
+
+        // recognize the induction variable and the exit test of a rotated loop
+        bool getControl(Loop *L, loop_ctrl &ctl){
+            BasicBlock *latch = L->getLoopLatch();
+            if (latch == NULL or L->getLoopPreheader() == NULL or L->getExitingBlock() != latch){
+                return false;
+            }
+            ctl.L = L;
+            ctl.br = dyn_cast<BranchInst>(latch->getTerminator());
+            if (ctl.br == NULL or !ctl.br->isConditional()) return false;
+            ctl.cmp = dyn_cast<ICmpInst>(ctl.br->getCondition());
+            if (ctl.cmp == NULL or !ctl.cmp->hasOneUse()) return false;
+
+            ctl.iv = NULL;
+            for (Instruction &I : *L->getHeader()){
+                PHINode *PN = dyn_cast<PHINode>(&I);
+                if (PN == NULL) break;
+                if (ctl.iv != NULL or PN->getNumIncomingValues() != 2) return false;
+                ctl.iv = PN;
+            }
+            if (ctl.iv == NULL or !ctl.iv->getType()->isIntegerTy()) return false;
+            ctl.next = dyn_cast<BinaryOperator>(ctl.iv->getIncomingValueForBlock(latch));
+            if (ctl.next == NULL or ctl.next->getOpcode() != Instruction::Add) return false;
+            if (ctl.next->getOperand(0) == ctl.iv and isa<ConstantInt>(ctl.next->getOperand(1))){
+                ctl.step_idx = 1;
+            }else if (ctl.next->getOperand(1) == ctl.iv and isa<ConstantInt>(ctl.next->getOperand(0))){
+                ctl.step_idx = 0;
+            }else{
+                return false;
+            }
+            for (User *U : ctl.next->users()){
+                if (U != ctl.iv and U != ctl.cmp) return false;
+            }
+            for (User *U : ctl.iv->users()){
+                if (!outermost->contains(cast<Instruction>(U))) return false;
+            }
+
+            space &sp = ctl.sp;
+            sp.start = ctl.iv->getIncomingValueForBlock(L->getLoopPreheader());
+            sp.step = ctl.next->getOperand(ctl.step_idx);
+            sp.bound = ctl.cmp->getOperand(1);
+            sp.pred = ctl.cmp->getPredicate();
+            sp.cmp_on_next = ctl.cmp->getOperand(0) == ctl.next;
+            sp.cont_on_true = ctl.br->getSuccessor(0) == L->getHeader();
+            sp.nsw = ctl.next->hasNoSignedWrap();
+            sp.nuw = ctl.next->hasNoUnsignedWrap();
+            if (!sp.cmp_on_next and ctl.cmp->getOperand(0) != ctl.iv) return false;
+            // rectangular nest: the iteration space may not depend on other loops
+            return isNestInvariant(sp.start) and isNestInvariant(sp.bound);
+        }
+
+        // the blocks of outer that are not in inner may only hold loop control
+        bool isPerfect(loop_ctrl &outer, Loop *inner){
+            for (BasicBlock *BB : outer.L->getBlocks()){
+                if (inner->contains(BB)) continue;
+                for (Instruction &I : *BB){
+                    if (&I == outer.iv or &I == outer.next or &I == outer.cmp or
+                        &I == outer.br or isa<DbgInfoIntrinsic>(I)){
+                        continue;
+                    }
+                    BranchInst *BI = dyn_cast<BranchInst>(&I);
+                    if (BI == NULL or BI->isConditional()) return false;
+                }
+            }
+            return true;
+        }
+
+        // step of S in bytes per iteration of L, NULL if it is not affine in L
+        const SCEV* getStride(const SCEV *S, const Loop *L, ScalarEvolution &SE){
+            while (const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S)){
+                if (!AR->isAffine()) return NULL;
+                if (AR->getLoop() == L) return AR->getStepRecurrence(SE);
+                S = AR->getStart();
+            }
+            if (!SE.isLoopInvariant(S, L)) return NULL;
+            return SE.getZero(S->getType());
+        }
+
+        // bytes of cache consumed per iteration of L by an access with this stride
+        uint64_t getFootprint(const SCEV *stride){
+            const SCEVConstant *C = dyn_cast_or_null<SCEVConstant>(stride);
+            if (C == NULL) return CacheLine;
+            uint64_t bytes = C->getAPInt().abs().getLimitedValue();
+            return bytes < CacheLine ? bytes : CacheLine;
+        }
+
+        // ---- dependences ----
+
+        // signs the distance, in iterations of one loop, between two accesses to the
+        // same bytes may have
+        enum{ DIR_LT = 1, DIR_EQ = 2, DIR_GT = 4, DIR_ALL = 7 };
+
+        struct dependence{
+            std::vector<unsigned> dirs;     // per loop of the nest, outermost first
+            std::vector<bool> invariant;    // the address is the same in every iteration
+        };
+
+        // solutions of sum coef[k] * d[k] == r over the loops from position p on, in
+        // descending |coef|; reach[p] bounds what the loops from p on can add up to.
+        // The signs of every solution are or-ed into dirs; false past the budget
+        bool solveDistances(const std::vector<unsigned> &loops, unsigned p, int64_t r,
+                            const std::vector<int64_t> &coef, const std::vector<int64_t> &reach,
+                            const std::vector<unsigned> &trips, std::vector<int> &signs,
+                            std::vector<unsigned> &dirs, unsigned &budget, bool &found){
+            if (p == loops.size()){
+                if (r != 0) return true;
+                found = true;
+                for (unsigned k : loops){
+                    dirs[k] |= signs[k] < 0 ? DIR_LT : signs[k] > 0 ? DIR_GT : DIR_EQ;
+                }
+                return true;
+            }
+            unsigned k = loops[p];
+            int64_t c = coef[k] < 0 ? -coef[k] : coef[k];
+            int64_t below = reach[p + 1];
+            if (below < 0) return false;
+            // c * e within below of r, e the distance with the sign of coef folded in
+            int64_t lo = r - below >= 0 ? (r - below + c - 1) / c : -((below - r) / c);
+            int64_t hi = r + below >= 0 ? (r + below) / c : -((-(r + below) + c - 1) / c);
+            if (trips[k] != 0){
+                lo = std::max(lo, -(int64_t)trips[k] + 1);
+                hi = std::min(hi, (int64_t)trips[k] - 1);
+            }
+            for (int64_t e = lo; e <= hi; e++){
+                if (budget-- == 0) return false;
+                int sign = (e > 0) - (e < 0);
+                signs[k] = coef[k] < 0 ? -sign : sign;
+                if (!solveDistances(loops, p + 1, r - c * e, coef, reach, trips, signs, dirs,
+                                    budget, found)){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // directions between two accesses of one base, per loop of the nest. Worked out
+        // when both move by the same constant stride in every loop and start a constant
+        // distance apart; false otherwise. independent: they never touch the same bytes
+        bool getDependence(mem_access &a, mem_access &b, std::vector<loop_ctrl> &nest,
+                           ScalarEvolution &SE, dependence &dep, bool &independent){
+            unsigned n = nest.size();
+            dep.dirs.assign(n, DIR_ALL);
+            dep.invariant.assign(n, false);
+            independent = false;
+            if (a.size != b.size) return false;
+            int64_t size = a.size;
+
+            std::vector<int64_t> coef(n);
+            std::vector<unsigned> trips(n);
+            std::vector<unsigned> loops;
+            for (unsigned k = 0; k < n; k++){
+                const SCEV *stride = getStride(a.ptr_scev, nest[k].L, SE);
+                if (stride == NULL or stride != getStride(b.ptr_scev, nest[k].L, SE)) return false;
+                const SCEVConstant *C = dyn_cast<SCEVConstant>(stride);
+                if (C == NULL or C->getAPInt().getSExtValue() % size != 0) return false;
+                coef[k] = C->getAPInt().getSExtValue() / size;
+                trips[k] = SE.getSmallConstantTripCount(nest[k].L);
+                dep.invariant[k] = coef[k] == 0;
+                if (coef[k] != 0) loops.push_back(k);
+            }
+            // a at iteration I and b at iteration I + d touch the same bytes when
+            // sum coef[k] * d[k] == a - b
+            const SCEVConstant *D = dyn_cast<SCEVConstant>(SE.getMinusSCEV(a.ptr_scev, b.ptr_scev));
+            if (D == NULL or D->getAPInt().getSExtValue() % size != 0) return false;
+            int64_t r = D->getAPInt().getSExtValue() / size;
+
+            std::sort(loops.begin(), loops.end(), [&](unsigned x, unsigned y){
+                return std::abs(coef[x]) > std::abs(coef[y]);
+            });
+            std::vector<int64_t> reach(loops.size() + 1, 0);
+            for (unsigned p = loops.size(); p-- > 0; ){
+                unsigned k = loops[p];
+                if (reach[p + 1] < 0 or trips[k] == 0){
+                    reach[p] = -1;      // unbounded
+                }else{
+                    reach[p] = reach[p + 1] + std::abs(coef[k]) * (int64_t)(trips[k] - 1);
+                }
+            }
+            std::vector<int> signs(n, 0);
+            std::vector<unsigned> dirs(n, 0);
+            unsigned budget = 256;
+            bool found = false;
+            if (!solveDistances(loops, 0, r, coef, reach, trips, signs, dirs, budget, found)){
+                return true;    // every direction stays possible
+            }
+            if (!found){
+                independent = true;
+                return true;
+            }
+            for (unsigned k : loops) dep.dirs[k] = dirs[k];
+            return true;
+        }
+
+        // every pair of accesses where one is a store, a store with itself included;
+        // false when one of them cannot be analysed
+        bool getDependences(std::vector<mem_access> &accesses, std::vector<loop_ctrl> &nest,
+                            ScalarEvolution &SE, AAResults &AA, std::vector<dependence> &deps){
+            for (unsigned i = 0; i < accesses.size(); i++){
+                for (unsigned j = i; j < accesses.size(); j++){
+                    mem_access &a = accesses[i];
+                    mem_access &b = accesses[j];
+                    if (!a.is_store and !b.is_store) continue;
+                    const SCEV *base_a = SE.getPointerBase(a.ptr_scev);
+                    const SCEV *base_b = SE.getPointerBase(b.ptr_scev);
+                    if (base_a != base_b){
+                        const SCEVUnknown *u_a = dyn_cast<SCEVUnknown>(base_a);
+                        const SCEVUnknown *u_b = dyn_cast<SCEVUnknown>(base_b);
+                        if (u_a == NULL or u_b == NULL or
+                            !AA.isNoAlias(u_a->getValue(), u_b->getValue())){
+                            return false;
+                        }
+                        continue;
+                    }
+                    dependence dep;
+                    bool independent;
+                    if (!getDependence(a, b, nest, SE, dep, independent)) return false;
+                    if (!independent) deps.push_back(dep);
+                }
+            }
+            return true;
+        }
+
+        // whether running the loops in order, order[k] the original index of the loop at
+        // depth k, keeps every dependence going the same way: for each mix of signs the
+        // dependence allows, the first loop with a nonzero distance must have the same
+        // sign in the new order as in the original one. An address the same in more than
+        // one of the moved loops is a chain of updates whose order would change
+        bool isOrderLegal(std::vector<dependence> &deps, const std::vector<unsigned> &order){
+            unsigned n = order.size();
+            for (dependence &dep : deps){
+                unsigned moved_invariant = 0;
+                for (unsigned k = 0; k < n; k++){
+                    if (order[k] != k and dep.invariant[order[k]]) moved_invariant++;
+                }
+                if (moved_invariant > 1) return false;
+
+                std::vector<int> signs(n, -1);
+                while (true){
+                    bool possible = true;
+                    for (unsigned k = 0; k < n; k++){
+                        unsigned dir = signs[k] < 0 ? DIR_LT : signs[k] > 0 ? DIR_GT : DIR_EQ;
+                        if (!(dep.dirs[k] & dir)) possible = false;
+                    }
+                    if (possible){
+                        int before = 0, after = 0;
+                        for (unsigned k = 0; k < n and before == 0; k++) before = signs[k];
+                        for (unsigned k = 0; k < n and after == 0; k++) after = signs[order[k]];
+                        if (before != after) return false;
+                    }
+                    // next mix of signs
+                    unsigned k = 0;
+                    while (k < n and signs[k] == 1) signs[k++] = -1;
+                    if (k == n) break;
+                    signs[k]++;
+                }
+            }
+            return true;
+        }
+
+        // interchange two adjacent loops: the spaces trade places and so do the
+        // uses of the induction variables in the body
+        void swapLoops(loop_ctrl &X, loop_ctrl &Y){
+            std::vector<Use*> x_uses, y_uses;
+            for (Use &U : X.iv->uses()){
+                if (U.getUser() != X.next and U.getUser() != X.cmp) x_uses.push_back(&U);
+            }
+            for (Use &U : Y.iv->uses()){
+                if (U.getUser() != Y.next and U.getUser() != Y.cmp) y_uses.push_back(&U);
+            }
+            for (Use *U : x_uses) U->set(Y.iv);
+            for (Use *U : y_uses) U->set(X.iv);
+            std::swap(X.sp, Y.sp);
+            applySpace(X);
+            applySpace(Y);
+        }
+
+        // rewrite the loop control of ctl to run its current space
+        void applySpace(loop_ctrl &ctl){
+            space &sp = ctl.sp;
+            ctl.iv->setIncomingValue(ctl.iv->getBasicBlockIndex(ctl.L->getLoopPreheader()), sp.start);
+            ctl.next->setOperand(ctl.step_idx, sp.step);
+            ctl.next->setHasNoSignedWrap(sp.nsw);
+            ctl.next->setHasNoUnsignedWrap(sp.nuw);
+            ctl.cmp->setPredicate(sp.pred);
+            ctl.cmp->setOperand(0, sp.cmp_on_next ? (Value*)ctl.next : (Value*)ctl.iv);
+            ctl.cmp->setOperand(1, sp.bound);
+            if ((ctl.br->getSuccessor(0) == ctl.L->getHeader()) != sp.cont_on_true){
+                ctl.br->swapSuccessors();
+            }
+        }
+
+        // strip-mine the innermost loop by tile and move the tile loop outside its parent:
+        //   for (jj = s; jj < e; jj += tile)
+        //     for (i ...)
+        //       for (j = jj; j < min(jj + tile, e); j++)
+        bool tileLoop(loop_ctrl &outer, loop_ctrl &inner, unsigned tile){
+            space &sp = inner.sp;
+            ConstantInt *step = dyn_cast<ConstantInt>(sp.step);
+            if (step == NULL or !step->isOne() or !sp.cmp_on_next) return false;
+            CmpInst::Predicate cont = sp.cont_on_true ? sp.pred : CmpInst::getInversePredicate(sp.pred);
+            bool is_signed;
+            if (cont == CmpInst::ICMP_SLT){
+                is_signed = true;
+            }else if (cont == CmpInst::ICMP_ULT){
+                is_signed = false;
+            }else if (cont == CmpInst::ICMP_NE){
+                is_signed = sp.nsw;
+            }else{
+                return false;
+            }
+
+            BasicBlock *preheader = outer.L->getLoopPreheader();
+            BasicBlock *header = outer.L->getHeader();
+            BasicBlock *latch = outer.L->getLoopLatch();
+            BasicBlock *exit = outer.L->getExitBlock();
+            if (exit == NULL) return false;
+            Function *F = header->getParent();
+            LLVMContext &Ctx = F->getContext();
+            Type *iv_type = inner.iv->getType();
+            Value *tile_step = ConstantInt::get(iv_type, tile);
+            CmpInst::Predicate lt = is_signed ? CmpInst::ICMP_SLT : CmpInst::ICMP_ULT;
+
+            BasicBlock *tile_header = BasicBlock::Create(Ctx, "bso_tile.header", F, header);
+            BasicBlock *tile_latch = BasicBlock::Create(Ctx, "bso_tile.latch", F, exit);
+
+            IRBuilder<> HB(tile_header);
+            PHINode *tile_iv = HB.CreatePHI(iv_type, 2, "bso_tile.iv");
+            Value *tile_next = HB.CreateAdd(tile_iv, tile_step, "bso_tile.end");
+            Value *tile_end = HB.CreateSelect(HB.CreateICmp(lt, tile_next, sp.bound),
+                                              tile_next, sp.bound, "bso_tile.bound");
+            HB.CreateBr(header);
+
+            IRBuilder<> LB(tile_latch);
+            Value *tile_iv_next = LB.CreateAdd(tile_iv, tile_step, "bso_tile.iv.next");
+            LB.CreateCondBr(LB.CreateICmp(lt, tile_iv_next, sp.bound), tile_header, exit);
+            tile_iv->addIncoming(sp.start, preheader);
+            tile_iv->addIncoming(tile_iv_next, tile_latch);
+
+            // preheader -> tile header -> outer loop -> tile latch -> exit
+            TerminatorInst *ph_term = preheader->getTerminator();
+            for (unsigned i = 0; i < ph_term->getNumSuccessors(); i++){
+                if (ph_term->getSuccessor(i) == header) ph_term->setSuccessor(i, tile_header);
+            }
+            outer.iv->setIncomingBlock(outer.iv->getBasicBlockIndex(preheader), tile_header);
+            for (unsigned i = 0; i < outer.br->getNumSuccessors(); i++){
+                if (outer.br->getSuccessor(i) == exit) outer.br->setSuccessor(i, tile_latch);
+            }
+            for (Instruction &I : *exit){
+                PHINode *PN = dyn_cast<PHINode>(&I);
+                if (PN == NULL) break;
+                int idx = PN->getBasicBlockIndex(latch);
+                if (idx >= 0) PN->setIncomingBlock(idx, tile_latch);
+            }
+
+            // the inner loop now runs one tile at a time
+            sp.start = tile_iv;
+            sp.bound = tile_end;
+            applySpace(inner);
+            return true;
+        }
+
+        bool runOnLoopNest(Loop *L0, ScalarEvolution &SE, AAResults &AA, const DataLayout &DL){
+            std::vector<loop_ctrl> nest;
+            std::vector<mem_access> accesses;
+            outermost = L0;
+            // a single loop is no nest, nothing to report
+            if (L0->getSubLoops().empty()) return false;
+            bso_phase_timer timer("bso_loop_nest.nest", "BSO loop nest: interchange and tiling");
+
+            // collect the chain of perfectly nested loops
+            Loop *L = L0;
+            while (true){
+                loop_ctrl ctl;
+                if (!getControl(L, ctl)){
+                    return missed(L, "UnsupportedLoopControl", "a loop is not controlled by one "
+                                  "affine induction variable");
+                }
+                ctl.sp.orig = nest.size();
+                nest.push_back(ctl);
+                if (L->getSubLoops().empty()) break;
+                if (L->getSubLoops().size() != 1 or !isPerfect(nest.back(), L->getSubLoops()[0])){
+                    return missed(L, "NotPerfectNest", "the loops are not perfectly nested");
+                }
+                L = L->getSubLoops()[0];
+            }
+            Type *iv_type = nest[0].iv->getType();
+            for (auto &ctl : nest){
+                if (ctl.iv->getType() != iv_type){
+                    return missed(L0, "MixedInductionTypes", "the induction variables have "
+                                  "different types");
+                }
+            }
+
+            // the body: only loads and stores touch memory, nothing escapes the nest
+            Loop *innermost = nest.back().L;
+            for (BasicBlock *BB : innermost->getBlocks()){
+                for (Instruction &I : *BB){
+                    if (isa<PHINode>(I) and &I != nest.back().iv){
+                        return missed(L0, "UnsupportedPhi", "the innermost loop carries a value "
+                                      "between iterations");
+                    }
+                    for (User *U : I.users()){
+                        if (!L0->contains(cast<Instruction>(U))){
+                            return missed(L0, "LiveOut", "a value computed in the nest is used after it");
+                        }
+                    }
+                    if (isa<DbgInfoIntrinsic>(I)) continue;
+                    if (LoadInst *LdI = dyn_cast<LoadInst>(&I)){
+                        if (!LdI->isSimple()){
+                            return missed(L0, "VolatileOrAtomic", "the nest has a volatile or atomic load");
+                        }
+                        mem_access a = {&I, SE.getSCEV(LdI->getPointerOperand()),
+                                        DL.getTypeStoreSize(LdI->getType()), false};
+                        accesses.push_back(a);
+                    }else if (StoreInst *SI = dyn_cast<StoreInst>(&I)){
+                        if (!SI->isSimple()){
+                            return missed(L0, "VolatileOrAtomic", "the nest has a volatile or atomic store");
+                        }
+                        mem_access a = {&I, SE.getSCEV(SI->getPointerOperand()),
+                                        DL.getTypeStoreSize(SI->getValueOperand()->getType()), true};
+                        accesses.push_back(a);
+                    }else if (I.mayReadOrWriteMemory() or I.mayHaveSideEffects()){
+                        return missed(L0, "SideEffects", "the nest has a call or another side effect");
+                    }
+                }
+            }
+            if (accesses.empty()) return missed(L0, "NoMemoryAccesses", "the nest does not access memory");
+            std::vector<dependence> deps;
+            if (!getDependences(accesses, nest, SE, AA, deps)){
+                return missed(L0, "Dependence", "a memory dependence could not be analysed");
+            }
+
+            // strides of every access with respect to every loop
+            std::vector<std::vector<const SCEV*> > strides(nest.size());
+            std::vector<uint64_t> cost(nest.size(), 0);
+            std::vector<unsigned> trips(nest.size(), 0);
+            for (unsigned k = 0; k < nest.size(); k++){
+                trips[k] = SE.getSmallConstantTripCount(nest[k].L);
+                for (auto &a : accesses){
+                    const SCEV *stride = getStride(a.ptr_scev, nest[k].L, SE);
+                    strides[k].push_back(stride);
+                    cost[k] += getFootprint(stride);
+                }
+            }
+
+            // interchange: bubble the loop with the cheapest accesses to the innermost spot
+            bool isChanged = false;
+            unsigned best = nest.size() - 1;
+            for (unsigned k = 0; k < nest.size(); k++){
+                if (cost[k] < cost[best]) best = k;
+            }
+            std::vector<unsigned> order(nest.size());
+            for (unsigned k = 0; k < nest.size(); k++) order[k] = k;
+            if (best + 1 < nest.size()){
+                std::vector<unsigned> moved = order;
+                moved.erase(moved.begin() + best);
+                moved.push_back(best);
+                if (isOrderLegal(deps, moved)){
+                    ORE.emit([&]{
+                        return OptimizationRemark(DEBUG_TYPE, "Interchanged", L0->getStartLoc(),
+                                                  L0->getHeader())
+                            << "loop at depth " << ore::NV("Depth", best + 1)
+                            << " moved innermost, its accesses have the smallest stride";
+                    });
+                    for (unsigned k = best; k + 1 < nest.size(); k++){
+                        swapLoops(nest[k], nest[k+1]);
+                        ++NumInterchanged;
+                    }
+                    order = moved;
+                    isChanged = true;
+                }else{
+                    ORE.emit([&]{
+                        return OptimizationRemarkMissed(DEBUG_TYPE, "InterchangeDependence",
+                                                        L0->getStartLoc(), L0->getHeader())
+                            << "loop at depth " << ore::NV("Depth", best + 1)
+                            << " not moved innermost: a memory dependence would be reversed";
+                    });
+                }
+            }
+
+            // tiling: one sweep of the innermost loop touches trip * footprint bytes; tile
+            // when that overflows the cache and the parent loop would reuse the lines
+            unsigned in_k = nest.back().sp.orig;
+            unsigned out_k = nest[nest.size() - 2].sp.orig;
+            uint64_t per_iter = 0;
+            bool has_reuse = false;
+            for (unsigned a = 0; a < accesses.size(); a++){
+                per_iter += getFootprint(strides[in_k][a]);
+                const SCEV *stride = strides[in_k][a];
+                if (stride != NULL and !stride->isZero() and
+                    getFootprint(strides[out_k][a]) < CacheLine){
+                    has_reuse = true;
+                }
+            }
+            unsigned trip = trips[in_k];
+            unsigned tile = TileSize;
+            if (tile == 0 and per_iter != 0){
+                tile = 1;
+                while ((uint64_t)tile * 2 * per_iter <= CacheSize) tile *= 2;
+            }
+            // the tiles run a part of the innermost loop before the rest of its parent
+            std::vector<unsigned> tiled = order;
+            std::swap(tiled[tiled.size() - 2], tiled.back());
+            if (has_reuse and tile >= 4 and (trip == 0 or trip > tile) and !isOrderLegal(deps, tiled)){
+                ORE.emit([&]{
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "TileDependence", L0->getStartLoc(),
+                                                    L0->getHeader())
+                        << "innermost loop not tiled: a memory dependence would be reversed";
+                });
+            }else if (has_reuse and tile >= 4 and (trip == 0 or trip > tile)){
+                if (tileLoop(nest[nest.size() - 2], nest.back(), tile)){
+                    ORE.emit([&]{
+                        return OptimizationRemark(DEBUG_TYPE, "Tiled", L0->getStartLoc(),
+                                                  L0->getHeader())
+                            << "innermost loop tiled by " << ore::NV("TileSize", tile)
+                            << ": one sweep of it overflows the cache and the outer loop reuses the lines";
+                    });
+                    ++NumTiled;
+                    isChanged = true;
+                    is_cfg_change = true;
+                }
+            }
+
+            if (isChanged) SE.forgetLoop(L0);
+            return isChanged;
+        }
+
+        bool runOnFunction(Function &F, LoopInfo &LI, ScalarEvolution &SE, AAResults &AA){
+            bool isChanged = false;
+            const DataLayout &DL = F.getParent()->getDataLayout();
+
+            // nests are independent, collect them before we start rewriting
+            std::vector<Loop*> nests(LI.begin(), LI.end());
+            for (Loop *L : nests){
+                isChanged |= runOnLoopNest(L, SE, AA, DL);
+            }
+            return isChanged;
+        }
+    };
+
+    struct bso_loop_nest : public FunctionPass{
+        static char ID;
+        bso_loop_nest() : FunctionPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequiredID(LoopSimplifyID);
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<ScalarEvolutionWrapperPass>();
+            AU.addRequired<AAResultsWrapperPass>();
+        }
+
+        bool runOnFunction(Function &F) override{
+            OptimizationRemarkEmitter ORE(&F);
+            return bso_loop_nest_impl(ORE).runOnFunction(F,
+                        getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                        getAnalysis<ScalarEvolutionWrapperPass>().getSE(),
+                        getAnalysis<AAResultsWrapperPass>().getAAResults());
+        }
+    };
+}
+
+PreservedAnalyses bso_loop_nest_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_loop_nest_impl impl(AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+    if (!impl.runOnFunction(F, AM.getResult<LoopAnalysis>(F), AM.getResult<ScalarEvolutionAnalysis>(F),
+                            AM.getResult<AAManager>(F))){
+        return PreservedAnalyses::all();
+    }
+    // tiling adds blocks LoopInfo does not know about; an interchange only
+    // rewrites the loop controls and SCEV already forgot the nest
+    if (impl.is_cfg_change) return PreservedAnalyses::none();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    PA.preserve<LoopAnalysis>();
+    PA.preserve<ScalarEvolutionAnalysis>();
+    return PA;
+}
+
+std::string bso_loop_nest_pass::options(){
+    return "bso-cache-size=" + std::to_string(CacheSize) +
+        " bso-cache-line=" + std::to_string(CacheLine) +
+        " bso-tile-size=" + std::to_string(TileSize);
+}
+
+char bso_loop_nest::ID = 0;
+static RegisterPass<bso_loop_nest> N("bso_loop_nest", "BSO: Loop Interchange and Tiling");
@@ -0,0 +1,252 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "passes.h"
+#include "phaseTimer.h"
+#include "functionExtract.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// bso-parallel-O2: bso-O2 over the functions of a module on a thread pool. None
+// of the BSO transforms looks across functions, so the module is cut into
+// partitions of a few thousand instructions, each is extracted into bitcode and
+// optimized in an LLVMContext of its own by a worker thread, and the optimized
+// bodies are spliced back. Every worker has a queue of partitions, biggest first,
+// and steals from the back of the others' once its own is empty.
+// The partitions depend on the module only and are spliced back in module order,
+// so the result does not depend on the number of threads or on which one ran what.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_parallel"
+STATISTIC(NumPartitions, "# of partitions optimized on the thread pool");
+STATISTIC(NumSteals, "# of partitions a worker took from another worker's queue");
+STATISTIC(NumSerial, "# of functions optimized on the calling thread");
+
+static cl::opt<unsigned> Threads("bso-threads", cl::init(0), cl::Hidden,
+        cl::desc("BSO: worker threads of bso-parallel-O2 (0 = one per core)"));
+static cl::opt<unsigned> PartitionSize("bso-partition-size", cl::init(4000), cl::Hidden,
+        cl::desc("BSO: instructions per partition of bso-parallel-O2"));
+
+namespace{
+    struct bso_partition{
+        std::vector<Function*> funcs;   // in module order
+        unsigned size = 0;              // # of instructions
+        SmallVector<char, 0> input;     // bitcode of the extracted functions
+        SmallVector<char, 0> output;    // and of the optimized ones, empty on failure
+        std::string diagnostics;        // what the passes reported, printed in order
+    };
+
+    // the remarks of a worker are kept with its partition, the calling thread
+    // prints them so that they do not interleave
+    struct partition_diagnostics : public DiagnosticHandler{
+        std::string &text;
+
+        partition_diagnostics(std::string &text) : text(text) {};
+
+        bool handleDiagnostics(const DiagnosticInfo &DI) override{
+            if (auto *OR = dyn_cast<DiagnosticInfoOptimizationBase>(&DI)){
+                if (!OR->isEnabled()) return true;
+            }
+            raw_string_ostream OS(text);
+            DiagnosticPrinterRawOStream DP(OS);
+            OS << LLVMContext::getDiagnosticMessagePrefix(DI.getSeverity()) << ": ";
+            DI.print(DP);
+            OS << "\n";
+            return true;
+        }
+    };
+
+    // a queue per worker: the owner takes from the front, a worker whose queue
+    // is empty steals from the back of the next non-empty one
+    class work_queues{
+        struct queue{
+            std::mutex lock;
+            std::deque<bso_partition*> work;
+        };
+        std::vector<std::unique_ptr<queue> > queues;
+
+    public:
+        work_queues(unsigned n){
+            for (unsigned i = 0; i < n; i++) queues.push_back(llvm::make_unique<queue>());
+        }
+
+        // only before the workers start
+        void push(unsigned worker, bso_partition *P){
+            queues[worker]->work.push_back(P);
+        }
+
+        // NULL once every queue is empty; nothing is pushed while the workers run
+        bso_partition *pop(unsigned worker){
+            for (unsigned i = 0; i < queues.size(); i++){
+                queue &q = *queues[(worker + i) % queues.size()];
+                std::lock_guard<std::mutex> guard(q.lock);
+                if (q.work.empty()) continue;
+                bso_partition *P;
+                if (i == 0){
+                    P = q.work.front();
+                    q.work.pop_front();
+                }else{
+                    P = q.work.back();
+                    q.work.pop_back();
+                    ++NumSteals;
+                }
+                return P;
+            }
+            return NULL;
+        }
+    };
+}
+
+// run on a worker thread: everything it touches lives in its own context
+static void optimizePartition(bso_partition &P, PassBuilder &PB){
+    LLVMContext Ctx;
+    Ctx.setDiagnosticHandler(llvm::make_unique<partition_diagnostics>(P.diagnostics));
+    MemoryBufferRef buffer(StringRef(P.input.data(), P.input.size()), "bso_partition");
+    Expected<std::unique_ptr<Module> > M = parseBitcodeFile(buffer, Ctx);
+    if (!M){
+        consumeError(M.takeError());
+        return;
+    }
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    FAM.registerPass([&]{ return PB.buildDefaultAAPipeline(); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    MPM.addPass(createModuleToFunctionPassAdaptor(bso_pipeline_pass()));
+    MPM.run(**M, MAM);
+
+    raw_svector_ostream OS(P.output);
+    WriteBitcodeToFile(**M, OS);
+}
+
+// consecutive functions up to PartitionSize instructions, bigger ones alone
+static void makePartitions(Module &M, FunctionAnalysisManager &FAM,
+                           std::vector<std::unique_ptr<bso_partition> > &partitions,
+                           SmallPtrSetImpl<Function*> &serial){
+    bso_partition *open = NULL;
+    for (Function &F : M){
+        if (F.isDeclaration()) continue;
+        if (!isExtractable(F)){
+            serial.insert(&F);
+            continue;
+        }
+        // the workers ask the target machine for the subtarget of F's attributes;
+        // created here, their lookups only read its subtarget map
+        FAM.getResult<TargetIRAnalysis>(F);
+
+        unsigned size = 0;
+        for (BasicBlock &BB : F) size += BB.size();
+        bso_partition *P = open;
+        if (size >= PartitionSize or open == NULL or open->size + size > PartitionSize){
+            partitions.push_back(llvm::make_unique<bso_partition>());
+            P = partitions.back().get();
+            if (size < PartitionSize) open = P;
+        }
+        P->funcs.push_back(&F);
+        P->size += size;
+    }
+    for (auto &P : partitions){
+        std::unique_ptr<Module> extracted = extractFunctions(P->funcs);
+        raw_svector_ostream OS(P->input);
+        WriteBitcodeToFile(*extracted, OS);
+    }
+}
+
+static void runWorkers(std::vector<std::unique_ptr<bso_partition> > &partitions, PassBuilder &PB){
+    unsigned n = Threads != 0 ? Threads : std::max(std::thread::hardware_concurrency(), 1u);
+    // the phase timers are not thread safe
+    if (TimePassesIsEnabled) n = 1;
+    n = std::min(n, (unsigned)partitions.size());
+
+    // biggest first, dealt round robin so that every worker starts with a big one
+    std::vector<bso_partition*> order;
+    for (auto &P : partitions) order.push_back(P.get());
+    std::stable_sort(order.begin(), order.end(), [](bso_partition *a, bso_partition *b){
+        return a->size > b->size;
+    });
+    work_queues queues(n);
+    for (unsigned i = 0; i < order.size(); i++) queues.push(i % n, order[i]);
+
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < n; w++){
+        workers.emplace_back([&queues, &PB, w]{
+            while (bso_partition *P = queues.pop(w)) optimizePartition(*P, PB);
+        });
+    }
+    for (std::thread &t : workers) t.join();
+    NumPartitions += partitions.size();
+}
+
+PreservedAnalyses bso_parallel_pass::run(Module &M, ModuleAnalysisManager &AM){
+    FunctionAnalysisManager &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    std::vector<std::unique_ptr<bso_partition> > partitions;
+    SmallPtrSet<Function*, 8> serial;
+    {
+        bso_phase_timer timer("bso_parallel.partition", "Partition and extract the functions");
+        makePartitions(M, FAM, partitions, serial);
+    }
+    if (partitions.empty() and serial.empty()) return PreservedAnalyses::all();
+
+    if (!partitions.empty()){
+        bso_phase_timer timer("bso_parallel.optimize", "Optimize the partitions");
+        runWorkers(partitions, PB);
+    }
+
+    {
+        bso_phase_timer timer("bso_parallel.splice", "Splice the optimized functions back");
+        for (auto &P : partitions){
+            errs() << P->diagnostics;
+            bool isSpliced = false;
+            if (!P->output.empty()){
+                MemoryBufferRef buffer(StringRef(P->output.data(), P->output.size()), "bso_partition");
+                Expected<std::unique_ptr<Module> > optimized = parseBitcodeFile(buffer, M.getContext());
+                if (optimized){
+                    isSpliced = spliceFunctions(P->funcs, **optimized);
+                }else{
+                    consumeError(optimized.takeError());
+                }
+            }
+            for (Function *F : P->funcs){
+                // what could not come back is optimized here instead
+                if (!isSpliced) serial.insert(F);
+                FAM.invalidate(*F, PreservedAnalyses::none());
+            }
+        }
+    }
+
+    for (Function &F : M){
+        if (!serial.count(&F)) continue;
+        ++NumSerial;
+        PreservedAnalyses PA = bso_pipeline_pass().run(F, FAM);
+        FAM.invalidate(F, PA);
+    }
+    // the function analyses were invalidated one by one already
+    PreservedAnalyses PA = PreservedAnalyses::none();
+    PA.preserve<FunctionAnalysisManagerModuleProxy>();
+    return PA;
+}
@@ -0,0 +1,97 @@
+// Goal : New pass manager interface of the BSO transforms. Every pass is defined
+// next to its legacy counterpart, both run the same implementation; plugin.cpp
+// registers them with opt -passes=.
+
+#ifndef BSO_PASSES_H
+#define BSO_PASSES_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+
+#include <string>
+
+namespace llvm{
+    class PassBuilder;
+}
+
+struct bso_cse_pass : public llvm::PassInfoMixin<bso_cse_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// turns the recursion into a loop, which changes the CFG
+struct bso_tre_pass : public llvm::PassInfoMixin<bso_tre_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+struct bso_cp_pass : public llvm::PassInfoMixin<bso_cp_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+struct bso_alg_simplify_pass : public llvm::PassInfoMixin<bso_alg_simplify_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// changes the CFG, but never the loops: no header is duplicated or jumped to
+struct bso_jump_thread_pass : public llvm::PassInfoMixin<bso_jump_thread_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    // the options it reads, part of the key of cached bso-O2 results
+    static std::string options();
+};
+
+struct bso_adce_pass : public llvm::PassInfoMixin<bso_adce_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+struct bso_dse_pass : public llvm::PassInfoMixin<bso_dse_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    // the options it reads, part of the key of cached bso-O2 results
+    static std::string options();
+};
+
+struct bso_loop_nest_pass : public llvm::PassInfoMixin<bso_loop_nest_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    // the options it reads, part of the key of cached bso-O2 results
+    static std::string options();
+};
+
+// runs over every innermost loop of the function, like the LLVM loop vectorizer,
+// so it is free to add the vector loop next to the one it came from
+struct bso_vectorize_pass : public llvm::PassInfoMixin<bso_vectorize_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    // the options it reads, part of the key of cached bso-O2 results
+    static std::string options();
+};
+
+struct bso_licm_pass : public llvm::PassInfoMixin<bso_licm_pass>{
+    llvm::PreservedAnalyses run(llvm::Loop &L, llvm::LoopAnalysisManager &AM,
+                                llvm::LoopStandardAnalysisResults &AR, llvm::LPMUpdater &U);
+};
+
+struct bso_ido_pass : public llvm::PassInfoMixin<bso_ido_pass>{
+    int counter = 0;    // numbers the new induction variables across loops
+
+    llvm::PreservedAnalyses run(llvm::Loop &L, llvm::LoopAnalysisManager &AM,
+                                llvm::LoopStandardAnalysisResults &AR, llvm::LPMUpdater &U);
+};
+
+// bso-O2: the transforms above iterated to a fixed point, see pipeline.cpp
+struct bso_pipeline_pass : public llvm::PassInfoMixin<bso_pipeline_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// bso-parallel-O2: bso-O2 over the functions of a module on a thread pool, see parallel.cpp
+struct bso_parallel_pass : public llvm::PassInfoMixin<bso_parallel_pass>{
+    llvm::PassBuilder &PB;      // sets up the analysis managers of the workers
+
+    bso_parallel_pass(llvm::PassBuilder &PB) : PB(PB) {};
+    llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+};
+
+// bso_inline: small callees into their callers, bottom-up over the call graph,
+// see inliner.cpp; there is no legacy version
+struct bso_inline_pass : public llvm::PassInfoMixin<bso_inline_pass>{
+    llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+};
+
+#endif
@@ -0,0 +1,18 @@
+// Goal : Time the phases of the BSO passes. With -time-passes they show up in
+// their own "BSO pass phases" group.
+
+#ifndef BSO_PHASE_TIMER_H
+#define BSO_PHASE_TIMER_H
+
+#include "llvm/Pass.h"
+#include "llvm/Support/Timer.h"
+
+struct bso_phase_timer{
+    llvm::NamedRegionTimer timer;
+
+    // name identifies the phase, e.g. "bso_licm.hoist"
+    bso_phase_timer(llvm::StringRef name, llvm::StringRef desc)
+        : timer(name, desc, "bso", "BSO pass phases", llvm::TimePassesIsEnabled) {};
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/LCSSA.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "passes.h"
+#include "functionCache.h"
+#include "profileModel.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// bso-O2: runs the scalar BSO transforms over a function until a whole sweep
+// changes nothing, then the loop restructuring passes once, then the scalar ones
+// again if those changed anything. Every change to the IR bumps a generation
+// counter; a pass that already ran on the current generation without changing
+// anything would only see the same IR again and is skipped.
+// With -bso-cache-dir a function whose IR was optimized before gets the cached
+// result instead, see functionCache.h.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_pipeline"
+STATISTIC(NumSweeps, "# of sweeps over the scalar passes");
+STATISTIC(NumPassRuns, "# of passes run by the pipeline");
+STATISTIC(NumPassSkips, "# of passes skipped because their input did not change");
+STATISTIC(NumCapHit, "# of functions stopped by the iteration cap");
+STATISTIC(NumBudgetHit, "# of functions stopped by the time budget");
+
+static cl::opt<unsigned> MaxIterations("bso-o2-max-iterations", cl::init(8), cl::Hidden,
+        cl::desc("BSO: maximum number of sweeps over the scalar passes per function"));
+static cl::opt<unsigned> BudgetMs("bso-o2-budget-ms", cl::init(2000), cl::Hidden,
+        cl::desc("BSO: wall-clock budget per function in milliseconds (0 = none)"));
+
+namespace{
+    typedef detail::PassConcept<Function, FunctionAnalysisManager> pass_concept;
+    typedef std::chrono::steady_clock wall_clock;
+
+    struct step{
+        std::unique_ptr<pass_concept> pass;
+        unsigned last_gen;      // generation the pass last ran on without a change
+    };
+
+    template <typename PassT>
+    step makeStep(PassT P){
+        typedef detail::PassModel<Function, PassT, PreservedAnalyses, FunctionAnalysisManager> model;
+        step s = {std::unique_ptr<pass_concept>(new model(std::move(P))), ~0u};
+        return s;
+    }
+
+    struct bso_pipeline{
+        Function &F;
+        FunctionAnalysisManager &AM;
+        PreservedAnalyses PA = PreservedAnalyses::all();
+        unsigned gen = 0;
+        unsigned sweeps = 0;
+        bool out_of_time = false;   // the result depends on the timing, do not cache it
+        wall_clock::time_point deadline;
+
+        bso_pipeline(Function &F, FunctionAnalysisManager &AM) : F(F), AM(AM) {};
+
+        bool outOfTime(){
+            out_of_time |= BudgetMs != 0 and wall_clock::now() > deadline;
+            return out_of_time;
+        }
+
+        // run one pass, keep the analysis manager up to date and report a change
+        bool runStep(step &s){
+            if (s.last_gen == gen){
+                ++NumPassSkips;
+                return false;
+            }
+            PreservedAnalyses PassPA = s.pass->run(F, AM);
+            ++NumPassRuns;
+            AM.invalidate(F, PassPA);
+            bool isChanged = !PassPA.areAllPreserved();
+            PA.intersect(std::move(PassPA));
+            if (isChanged){
+                gen++;
+            }else{
+                s.last_gen = gen;
+            }
+            return isChanged;
+        }
+
+        // false when the cap or the budget stopped us before the fixed point
+        bool runToFixedPoint(std::vector<step> &steps){
+            bool iterChanged = true;
+            while (iterChanged){
+                if (sweeps == MaxIterations){
+                    ++NumCapHit;
+                    return false;
+                }
+                sweeps++;
+                ++NumSweeps;
+                iterChanged = false;
+                for (step &s : steps){
+                    if (outOfTime()){
+                        ++NumBudgetHit;
+                        return false;
+                    }
+                    iterChanged |= runStep(s);
+                }
+            }
+            return true;
+        }
+
+        void run(){
+            std::vector<step> scalar;
+            // the loops it makes are for licm and ido in the same sweep
+            scalar.push_back(makeStep(bso_tre_pass()));
+            scalar.push_back(makeStep(bso_cp_pass()));
+            scalar.push_back(makeStep(bso_alg_simplify_pass()));
+            // the branches cp and alg_simplify left on constants
+            scalar.push_back(makeStep(bso_jump_thread_pass()));
+            scalar.push_back(makeStep(bso_cse_pass()));
+            // licm and ido weigh their changes by the block frequencies, which they
+            // can only take from the cache; recomputed once a change dropped them
+            scalar.push_back(makeStep(RequireAnalysisPass<BlockFrequencyAnalysis, Function>()));
+            scalar.push_back(makeStep(createFunctionToLoopPassAdaptor(bso_licm_pass())));
+            scalar.push_back(makeStep(RequireAnalysisPass<BlockFrequencyAnalysis, Function>()));
+            scalar.push_back(makeStep(createFunctionToLoopPassAdaptor(bso_ido_pass())));
+            scalar.push_back(makeStep(bso_dse_pass()));
+            scalar.push_back(makeStep(bso_adce_pass()));
+
+            // the loop passes want canonical loops, which the scalar passes may break
+            std::vector<step> loops;
+            loops.push_back(makeStep(LoopSimplifyPass()));
+            loops.push_back(makeStep(bso_loop_nest_pass()));
+            loops.push_back(makeStep(LCSSAPass()));
+            loops.push_back(makeStep(bso_vectorize_pass()));
+
+            deadline = wall_clock::now() + std::chrono::milliseconds(BudgetMs);
+            if (!runToFixedPoint(scalar)) return;
+
+            unsigned loop_gen = gen;
+            for (step &s : loops){
+                if (outOfTime()){
+                    ++NumBudgetHit;
+                    return;
+                }
+                runStep(s);
+            }
+            if (gen != loop_gen) runToFixedPoint(scalar);
+        }
+    };
+}
+
+PreservedAnalyses bso_pipeline_pass::run(Function &F, FunctionAnalysisManager &AM){
+    if (F.isDeclaration()) return PreservedAnalyses::all();
+    bso_function_cache *cache = bso_function_cache::get();
+    std::string key;
+    if (cache != NULL and cache->isCacheable(F)){
+        // the budget is left out: results it cut short are not stored
+        std::string options = "bso-O2 max-iterations=" + std::to_string(MaxIterations) +
+            " " + bso_jump_thread_pass::options() + " " + bso_dse_pass::options() +
+            " " + bso_loop_nest_pass::options() + " " + bso_vectorize_pass::options() +
+            " " + bso_profile_model::options();
+        key = cache->getKey(F, options);
+        if (cache->lookup(F, key)) return PreservedAnalyses::none();
+    }
+
+    bso_pipeline pipeline(F, AM);
+    pipeline.run();
+    if (!key.empty() and !pipeline.out_of_time) cache->store(F, key);
+    // like a pass manager: the analyses were invalidated after each step already
+    pipeline.PA.preserveSet<AllAnalysesOn<Function> >();
+    return std::move(pipeline.PA);
+}
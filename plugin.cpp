@@ -0,0 +1,142 @@
+// Goal : Register the BSO passes and analyses with the new pass manager, so that
+// they can be used as opt -load-pass-plugin=bso_optimization.so -passes=bso_cse,...
+// The legacy passes keep registering themselves through RegisterPass.
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Transforms/Utils/LCSSA.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "passes.h"
+#include "dominanceAnalysis.h"
+#include "livenessAnalysis.h"
+#include "rangeAnalysis.h"
+#include "knownBitsAnalysis.h"
+
+using namespace llvm;
+
+// require<A>, invalidate<A> and print<A> for one of our analyses
+template <typename AnalysisT, typename PrinterT>
+static bool parseAnalysisPass(StringRef Name, StringRef AnalysisName, FunctionPassManager &FPM){
+    if (Name == ("require<" + AnalysisName + ">").str()){
+        FPM.addPass(RequireAnalysisPass<AnalysisT, Function>());
+        return true;
+    }
+    if (Name == ("invalidate<" + AnalysisName + ">").str()){
+        FPM.addPass(InvalidateAnalysisPass<AnalysisT>());
+        return true;
+    }
+    if (Name == ("print<" + AnalysisName + ">").str()){
+        FPM.addPass(PrinterT());
+        return true;
+    }
+    return false;
+}
+
+static bool parseFunctionPass(StringRef Name, FunctionPassManager &FPM,
+                              ArrayRef<PassBuilder::PipelineElement> InnerPipeline){
+    if (Name == "bso_cse"){
+        FPM.addPass(bso_cse_pass());
+        return true;
+    }
+    if (Name == "bso_tre"){
+        FPM.addPass(bso_tre_pass());
+        return true;
+    }
+    if (Name == "bso_cp"){
+        FPM.addPass(bso_cp_pass());
+        return true;
+    }
+    if (Name == "bso_alg_simplify"){
+        FPM.addPass(bso_alg_simplify_pass());
+        return true;
+    }
+    if (Name == "bso_jump_thread"){
+        FPM.addPass(bso_jump_thread_pass());
+        return true;
+    }
+    if (Name == "bso_adce"){
+        FPM.addPass(bso_adce_pass());
+        return true;
+    }
+    if (Name == "bso_dse"){
+        FPM.addPass(bso_dse_pass());
+        return true;
+    }
+    if (Name == "bso-O2"){
+        FPM.addPass(bso_pipeline_pass());
+        return true;
+    }
+    // the legacy passes require loop-simplify (and lcssa), do the same here
+    if (Name == "bso_loop_nest"){
+        FPM.addPass(LoopSimplifyPass());
+        FPM.addPass(bso_loop_nest_pass());
+        return true;
+    }
+    if (Name == "bso_vectorize"){
+        FPM.addPass(LoopSimplifyPass());
+        FPM.addPass(LCSSAPass());
+        FPM.addPass(bso_vectorize_pass());
+        return true;
+    }
+
+    // the dominance and liveness passes used to print their result as they ran
+    if (Name == "bso_dominance_analysis"){
+        FPM.addPass(bso_dominance_printer_pass());
+        return true;
+    }
+    if (Name == "bso_liveness_analysis"){
+        FPM.addPass(bso_liveness_printer_pass());
+        return true;
+    }
+    return parseAnalysisPass<bso_dominance_analysis, bso_dominance_printer_pass>(
+                Name, "bso_dominance_analysis", FPM) or
+           parseAnalysisPass<bso_liveness_analysis, bso_liveness_printer_pass>(
+                Name, "bso_liveness_analysis", FPM) or
+           parseAnalysisPass<bso_range_analysis, bso_range_printer_pass>(
+                Name, "bso_range_analysis", FPM) or
+           parseAnalysisPass<bso_known_bits_analysis, bso_known_bits_printer_pass>(
+                Name, "bso_known_bits_analysis", FPM);
+}
+
+static bool parseLoopPass(StringRef Name, LoopPassManager &LPM,
+                          ArrayRef<PassBuilder::PipelineElement> InnerPipeline){
+    if (Name == "bso_licm"){
+        LPM.addPass(bso_licm_pass());
+        return true;
+    }
+    if (Name == "bso_ido"){
+        LPM.addPass(bso_ido_pass());
+        return true;
+    }
+    return false;
+}
+
+static void registerAnalyses(FunctionAnalysisManager &FAM){
+    FAM.registerPass([]{ return bso_dominance_analysis(); });
+    FAM.registerPass([]{ return bso_liveness_analysis(); });
+    FAM.registerPass([]{ return bso_range_analysis(); });
+    FAM.registerPass([]{ return bso_known_bits_analysis(); });
+}
+
+static void registerCallbacks(PassBuilder &PB){
+    PB.registerAnalysisRegistrationCallback(registerAnalyses);
+    PB.registerPipelineParsingCallback(parseFunctionPass);
+    PB.registerPipelineParsingCallback(parseLoopPass);
+    // the parallel driver builds the analysis managers of its threads with PB
+    PB.registerPipelineParsingCallback(
+        [&PB](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>){
+            if (Name != "bso-parallel-O2") return false;
+            MPM.addPass(bso_parallel_pass(PB));
+            return true;
+        });
+    PB.registerPipelineParsingCallback(
+        [](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>){
+            if (Name != "bso_inline") return false;
+            MPM.addPass(bso_inline_pass());
+            return true;
+        });
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo(){
+    return {LLVM_PLUGIN_API_VERSION, "bso_optimization", LLVM_VERSION_STRING, registerCallbacks};
+}
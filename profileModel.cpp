@@ -0,0 +1,94 @@
+#include "profileModel.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <mutex>
+
+using namespace llvm;
+
+static cl::opt<bool> ProfileGuided("bso-pgo", cl::init(true), cl::Hidden,
+        cl::desc("BSO: weigh transforms by block frequency and profile counts"));
+static cl::opt<unsigned> ColdRatio("bso-pgo-cold-ratio", cl::init(100), cl::Hidden,
+        cl::desc("BSO: a block is cold when it runs less than 1/N as often as the function entry"));
+static cl::opt<bool> Report("bso-pgo-report", cl::init(false), cl::Hidden,
+        cl::desc("BSO: print the estimated dynamic instructions each transform saved on exit"));
+
+namespace{
+    // per transform, printed when the plugin shuts down like -stats
+    struct savings_report{
+        struct row{
+            double profiled = 0;        // from profile counts
+            double per_call = 0;        // from the static estimate
+            unsigned applied = 0;
+            unsigned rejected = 0;
+        };
+        std::mutex lock;                // bso-parallel-O2 reports from several threads
+        StringMap<row> rows;
+
+        ~savings_report(){
+            if (!Report or rows.empty()) return;
+            raw_ostream &OS = errs();
+            OS << "===-------------------------------------------------------------------===\n"
+               << "              BSO estimated dynamic instruction savings\n"
+               << "===-------------------------------------------------------------------===\n"
+               << "  transform                    profiled       per call  applied rejected\n";
+            for (auto &it : rows){
+                row &r = it.second;
+                OS << format("  %-20s %16.0f %14.1f %8u %8u\n", it.first().str().c_str(),
+                             r.profiled, r.per_call, r.applied, r.rejected);
+            }
+            OS << "\n";
+        }
+    };
+}
+
+static ManagedStatic<savings_report> Savings;
+
+bso_profile_model::bso_profile_model(BlockFrequencyInfo *BFI, Function &F)
+    : BFI(ProfileGuided ? BFI : NULL){
+    if (this->BFI == NULL) return;
+    entry_freq = this->BFI->getEntryFreq();
+    has_profile = F.getEntryCount().hasValue();
+}
+
+double bso_profile_model::getCount(BasicBlock *BB){
+    if (BFI == NULL or entry_freq == 0) return 1;
+    if (has_profile){
+        Optional<uint64_t> count = BFI->getBlockProfileCount(BB);
+        if (count) return *count;
+    }
+    return (double)BFI->getBlockFreq(BB).getFrequency() / entry_freq;
+}
+
+bool bso_profile_model::isCold(BasicBlock *BB){
+    if (BFI == NULL) return false;
+    return BFI->getBlockFreq(BB).getFrequency() * ColdRatio < entry_freq;
+}
+
+void bso_profile_model::applied(StringRef transform, double saved){
+    if (BFI == NULL) return;
+    std::lock_guard<std::mutex> guard(Savings->lock);
+    savings_report::row &r = Savings->rows[transform];
+    if (has_profile){
+        r.profiled += saved;
+    }else{
+        r.per_call += saved;
+    }
+    r.applied++;
+}
+
+void bso_profile_model::rejected(StringRef transform){
+    if (BFI == NULL) return;
+    std::lock_guard<std::mutex> guard(Savings->lock);
+    Savings->rows[transform].rejected++;
+}
+
+std::string bso_profile_model::options(){
+    return std::string("bso-pgo=") + (ProfileGuided ? "1" : "0") +
+        " bso-pgo-cold-ratio=" + std::to_string(ColdRatio) +
+        " bso-pgo-report=" + (Report ? "1" : "0");
+}
@@ -0,0 +1,37 @@
+// Goal : How often the blocks of a function run, for the cost models of the BSO
+// transforms. Counts come from BlockFrequencyInfo: the profile counts when the
+// function has !prof data (e.g. from pgo-instr-use and a .profdata file), the
+// static estimate relative to one call otherwise. Transforms weigh what they
+// remove against what they add with it and report the difference, see
+// -bso-pgo-report.
+
+#ifndef BSO_PROFILE_MODEL_H
+#define BSO_PROFILE_MODEL_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/IR/BasicBlock.h"
+
+#include <string>
+
+struct bso_profile_model{
+    llvm::BlockFrequencyInfo *BFI;     // NULL: every block is as hot as any other
+    uint64_t entry_freq = 0;
+    bool has_profile = false;
+
+    bso_profile_model(llvm::BlockFrequencyInfo *BFI, llvm::Function &F);
+
+    // executions of BB: profile counts, or per call of the function without profile
+    double getCount(llvm::BasicBlock *BB);
+    // runs less than -bso-pgo-cold-ratio of the function entry
+    bool isCold(llvm::BasicBlock *BB);
+
+    // what a transform expects to save in dynamic instructions, taken or rejected
+    void applied(llvm::StringRef transform, double saved);
+    void rejected(llvm::StringRef transform);
+
+    // the -bso-pgo options, part of the key of cached bso-O2 results
+    static std::string options();
+};
+
+#endif
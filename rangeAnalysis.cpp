@@ -0,0 +1,269 @@
+#include "rangeAnalysis.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+// how far getRange follows operands before giving up with the full set
+static const unsigned MaxDepth = 6;
+
+void bso_range_info::forgetValue(Value *V){
+    cache.erase(V);
+}
+
+bool bso_range_info::invalidate(Function &F, const PreservedAnalyses &PA,
+                                FunctionAnalysisManager::Invalidator &Inv){
+    auto PAC = PA.getChecker<bso_range_analysis>();
+    if (!PAC.preserved() and !PAC.preservedSet<AllAnalysesOn<Function> >()) return true;
+    return Inv.invalidate<DominatorTreeAnalysis>(F, PA) or
+           Inv.invalidate<ScalarEvolutionAnalysis>(F, PA);
+}
+
+ConstantRange bso_range_info::getRange(Value *V, BasicBlock *BB){
+    return getRangeImpl(V, BB, 0);
+}
+
+bool bso_range_info::isKnownNonNegative(Value *V, BasicBlock *BB){
+    return getRange(V, BB).getSignedMin().isNonNegative();
+}
+
+Optional<bool> bso_range_info::evaluateCompare(ICmpInst *I){
+    Value *lhs = I->getOperand(0);
+    Value *rhs = I->getOperand(1);
+    CmpInst::Predicate pred = I->getPredicate();
+    if (!lhs->getType()->isIntegerTy()) return None;
+
+    // compare the ranges of both sides in the block of the compare
+    ConstantRange lhs_range = getRange(lhs, I->getParent());
+    ConstantRange rhs_range = getRange(rhs, I->getParent());
+    if (ConstantRange::makeSatisfyingICmpRegion(pred, rhs_range).contains(lhs_range)){
+        return true;
+    }
+    if (ConstantRange::makeSatisfyingICmpRegion(CmpInst::getInversePredicate(pred),
+                                               rhs_range).contains(lhs_range)){
+        return false;
+    }
+
+    // relate the two sides symbolically, e.g. i < n inside a loop guarded by it
+    if (SE->isSCEVable(lhs->getType())){
+        const SCEV *lhs_scev = SE->getSCEV(lhs);
+        const SCEV *rhs_scev = SE->getSCEV(rhs);
+        if (SE->isKnownPredicate(pred, lhs_scev, rhs_scev)) return true;
+        if (SE->isKnownPredicate(CmpInst::getInversePredicate(pred), lhs_scev, rhs_scev)){
+            return false;
+        }
+    }
+    return None;
+}
+
+ConstantRange bso_range_info::getRangeImpl(Value *V, BasicBlock *BB, unsigned depth){
+    unsigned width = V->getType()->getIntegerBitWidth();
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(V)){
+        return ConstantRange(CI->getValue());
+    }
+    if (!isa<Instruction>(V) and !isa<Argument>(V)){
+        return ConstantRange(width, true);
+    }
+
+    auto found = cache.find(V);
+    if (found != cache.end()){
+        auto at = found->second.find(BB);
+        if (at != found->second.end()) return at->second;
+    }
+    if (depth > MaxDepth or in_progress.count(V)){
+        return ConstantRange(width, true);
+    }
+
+    in_progress.insert(V);
+    ConstantRange R(width, true);
+    if (Instruction *I = dyn_cast<Instruction>(V)){
+        R = getDefRange(I, BB, depth);
+    }
+    R = R.intersectWith(getSCEVRange(V));
+    if (BB != NULL){
+        R = R.intersectWith(getConditionRange(V, BB, depth));
+    }
+    in_progress.erase(V);
+
+    cache[V].insert(std::make_pair(BB, R));
+    return R;
+}
+
+// range implied by the operation that defines I
+ConstantRange bso_range_info::getDefRange(Instruction *I, BasicBlock *BB, unsigned depth){
+    unsigned width = I->getType()->getIntegerBitWidth();
+
+    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(I)){
+        ConstantRange lhs = getRangeImpl(BO->getOperand(0), BB, depth + 1);
+        ConstantRange rhs = getRangeImpl(BO->getOperand(1), BB, depth + 1);
+        switch (BO->getOpcode()){
+            case Instruction::URem:
+                // x urem y is below y and never above x
+                if (!rhs.contains(APInt(width, 0))){
+                    APInt max = APIntOps::umin(lhs.getUnsignedMax(), rhs.getUnsignedMax() - 1);
+                    return ConstantRange(APInt(width, 0), max + 1);
+                }
+                return ConstantRange(width, true);
+            case Instruction::SRem:
+                // a non-negative x srem y stays in [0, |y|)
+                if (lhs.getSignedMin().isNonNegative() and !rhs.contains(APInt(width, 0)) and
+                    rhs.getSignedMin().isNonNegative()){
+                    APInt max = APIntOps::umin(lhs.getUnsignedMax(), rhs.getUnsignedMax() - 1);
+                    return ConstantRange(APInt(width, 0), max + 1);
+                }
+                return ConstantRange(width, true);
+            case Instruction::AShr:
+                // same as lshr when the shifted value is non-negative
+                if (lhs.getSignedMin().isNonNegative()){
+                    return lhs.binaryOp(Instruction::LShr, rhs);
+                }
+                return ConstantRange(width, true);
+            default:
+                // add, sub, mul, udiv, shl, lshr, and, or
+                return lhs.binaryOp(BO->getOpcode(), rhs);
+        }
+    }
+
+    if (CastInst *CI = dyn_cast<CastInst>(I)){
+        if (!CI->getOperand(0)->getType()->isIntegerTy()) return ConstantRange(width, true);
+        ConstantRange src = getRangeImpl(CI->getOperand(0), BB, depth + 1);
+        switch (CI->getOpcode()){
+            case Instruction::ZExt:
+                return src.zeroExtend(width);
+            case Instruction::SExt:
+                return src.signExtend(width);
+            case Instruction::Trunc:
+                return src.truncate(width);
+            default:
+                return ConstantRange(width, true);
+        }
+    }
+
+    if (SelectInst *SI = dyn_cast<SelectInst>(I)){
+        return getRangeImpl(SI->getTrueValue(), BB, depth + 1).unionWith(
+                    getRangeImpl(SI->getFalseValue(), BB, depth + 1));
+    }
+
+    if (PHINode *PN = dyn_cast<PHINode>(I)){
+        // each incoming value is looked at from the block it flows in from
+        ConstantRange R(width, false);
+        for (unsigned i = 0; i < PN->getNumIncomingValues(); i++){
+            R = R.unionWith(getRangeImpl(PN->getIncomingValue(i), PN->getIncomingBlock(i), depth + 1));
+            if (R.isFullSet()) break;
+        }
+        return R;
+    }
+
+    return ConstantRange(width, true);
+}
+
+// SCEV knows the bounds of induction variables from the loop trip counts
+ConstantRange bso_range_info::getSCEVRange(Value *V){
+    unsigned width = V->getType()->getIntegerBitWidth();
+    if (!SE->isSCEVable(V->getType())) return ConstantRange(width, true);
+    const SCEV *S = SE->getSCEV(V);
+    return SE->getSignedRange(S).intersectWith(SE->getUnsignedRange(S));
+}
+
+// walk up the dominator tree from BB; every block entered only through one
+// edge of a conditional branch inherits the condition of that branch
+ConstantRange bso_range_info::getConditionRange(Value *V, BasicBlock *BB, unsigned depth){
+    unsigned width = V->getType()->getIntegerBitWidth();
+    ConstantRange R(width, true);
+    if (!DT->isReachableFromEntry(BB)) return R;
+
+    for (DomTreeNode *node = DT->getNode(BB); node != NULL; node = node->getIDom()){
+        BasicBlock *curr_bb = node->getBlock();
+        BasicBlock *pred = curr_bb->getSinglePredecessor();
+        if (pred == NULL) continue;
+        BranchInst *BI = dyn_cast<BranchInst>(pred->getTerminator());
+        if (BI == NULL or !BI->isConditional() or BI->getSuccessor(0) == BI->getSuccessor(1)){
+            continue;
+        }
+        applyCondition(BI->getCondition(), BI->getSuccessor(0) == curr_bb, V, pred, depth, R);
+    }
+    return R;
+}
+
+// narrow R by what cond being is_true says about V
+void bso_range_info::applyCondition(Value *cond, bool is_true, Value *V, BasicBlock *pred,
+                                        unsigned depth, ConstantRange &R){
+    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(cond)){
+        // (a and b) true means both hold, (a or b) false means neither does
+        if ((BO->getOpcode() == Instruction::And and is_true) or
+            (BO->getOpcode() == Instruction::Or and !is_true)){
+            applyCondition(BO->getOperand(0), is_true, V, pred, depth, R);
+            applyCondition(BO->getOperand(1), is_true, V, pred, depth, R);
+        }
+        return;
+    }
+
+    ICmpInst *cmp = dyn_cast<ICmpInst>(cond);
+    if (cmp == NULL) return;
+    CmpInst::Predicate p = cmp->getPredicate();
+    Value *other;
+    if (cmp->getOperand(0) == V){
+        other = cmp->getOperand(1);
+    }else if (cmp->getOperand(1) == V){
+        other = cmp->getOperand(0);
+        p = CmpInst::getSwappedPredicate(p);
+    }else{
+        return;
+    }
+    if (!is_true) p = CmpInst::getInversePredicate(p);
+    ConstantRange other_range = getRangeImpl(other, pred, depth + 1);
+    R = R.intersectWith(ConstantRange::makeAllowedICmpRegion(p, other_range));
+}
+
+void bso_range_info::print(raw_ostream &O){
+    for (inst_iterator I = inst_begin(curr_func), E = inst_end(curr_func); I != E; ++I){
+        if (!I->getType()->isIntegerTy() or !I->hasName()) continue;
+        O << I->getName() << " : " << getRange(&*I, I->getParent()) << "\n";
+    }
+}
+
+// ---- new pass manager ----
+
+AnalysisKey bso_range_analysis::Key;
+
+bso_range_info bso_range_analysis::run(Function &F, FunctionAnalysisManager &AM){
+    // nothing is computed up front, clients ask for the values they care about
+    return bso_range_info(F, AM.getResult<DominatorTreeAnalysis>(F),
+                          AM.getResult<ScalarEvolutionAnalysis>(F));
+}
+
+PreservedAnalyses bso_range_printer_pass::run(Function &F, FunctionAnalysisManager &AM){
+    AM.getResult<bso_range_analysis>(F).print(errs());
+    return PreservedAnalyses::all();
+}
+
+// ---- legacy pass manager ----
+
+void bso_range_wrapper::getAnalysisUsage(AnalysisUsage &AU) const{
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.setPreservesAll();
+}
+
+bool bso_range_wrapper::runOnFunction(Function &F){
+    info.reset(new bso_range_info(F, getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+                                  getAnalysis<ScalarEvolutionWrapperPass>().getSE()));
+    return false;
+}
+
+void bso_range_wrapper::releaseMemory(){
+    info.reset();
+}
+
+void bso_range_wrapper::print(raw_ostream &O, const Module *M) const{
+    if (info) info->print(O);
+}
+
+char bso_range_wrapper::ID = 0;
+static RegisterPass<bso_range_wrapper> R("bso_range_analysis", "BSO: Value Range Analysis",
+                                         false, true);
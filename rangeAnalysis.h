@@ -0,0 +1,86 @@
+// Goal : Sparse value range analysis over SSA. The range of a value is computed
+// on demand from its definition, SCEV and the branch conditions dominating the
+// block it is looked at from, and cached per (value, block).
+
+#ifndef BSO_RANGE_ANALYSIS_H
+#define BSO_RANGE_ANALYSIS_H
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+#include <map>
+#include <memory>
+#include <set>
+
+namespace llvm{
+    class DominatorTree;
+    class ScalarEvolution;
+}
+
+// the analysis result, shared by both pass managers
+struct bso_range_info{
+    bso_range_info(llvm::Function &F, llvm::DominatorTree &DT, llvm::ScalarEvolution &SE)
+        : curr_func(&F), DT(&DT), SE(&SE) {};
+
+    // range of the integer value V whenever control is in BB (NULL: anywhere)
+    llvm::ConstantRange getRange(llvm::Value *V, llvm::BasicBlock *BB);
+
+    // outcome of the compare if the ranges of its operands or SCEV decide it
+    llvm::Optional<bool> evaluateCompare(llvm::ICmpInst *I);
+
+    bool isKnownNonNegative(llvm::Value *V, llvm::BasicBlock *BB);
+
+    // drop the cached ranges of V; clients call this before erasing V
+    void forgetValue(llvm::Value *V);
+
+    void print(llvm::raw_ostream &O);
+
+    // new pass manager: stale once the dominator tree or SCEV are
+    bool invalidate(llvm::Function &F, const llvm::PreservedAnalyses &PA,
+                    llvm::FunctionAnalysisManager::Invalidator &Inv);
+
+private:
+    llvm::Function *curr_func;
+    llvm::DominatorTree *DT;
+    llvm::ScalarEvolution *SE;
+    std::map<llvm::Value*, std::map<llvm::BasicBlock*, llvm::ConstantRange> > cache;
+    std::set<llvm::Value*> in_progress;     // breaks cycles through phis
+
+    llvm::ConstantRange getRangeImpl(llvm::Value *V, llvm::BasicBlock *BB, unsigned depth);
+    llvm::ConstantRange getDefRange(llvm::Instruction *I, llvm::BasicBlock *BB, unsigned depth);
+    llvm::ConstantRange getSCEVRange(llvm::Value *V);
+    llvm::ConstantRange getConditionRange(llvm::Value *V, llvm::BasicBlock *BB, unsigned depth);
+    void applyCondition(llvm::Value *cond, bool is_true, llvm::Value *V, llvm::BasicBlock *pred,
+                        unsigned depth, llvm::ConstantRange &R);
+};
+
+// new pass manager analysis
+struct bso_range_analysis : public llvm::AnalysisInfoMixin<bso_range_analysis>{
+    typedef bso_range_info Result;
+    bso_range_info run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    static llvm::AnalysisKey Key;
+};
+
+struct bso_range_printer_pass : public llvm::PassInfoMixin<bso_range_printer_pass>{
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+};
+
+// legacy pass manager wrapper
+struct bso_range_wrapper : public llvm::FunctionPass{
+    static char ID;
+    bso_range_wrapper() : llvm::FunctionPass(ID) {};
+
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+    bool runOnFunction(llvm::Function &F) override;
+    void releaseMemory() override;
+    void print(llvm::raw_ostream &O, const llvm::Module *M) const override;
+
+    bso_range_info &getInfo() { return *info; }
+
+private:
+    std::unique_ptr<bso_range_info> info;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "passes.h"
+#include "phaseTimer.h"
+
+#include <vector>
+
+// tail recursion elimination: a call of the function to itself whose result is
+// returned as is becomes a jump back to the start, with a phi per argument in
+// a new loop header after the allocas of the entry block. A result combined
+// with one more value by an associative and commutative operation,
+// return n * f(n - 1), is kept in an accumulator phi instead, and every
+// remaining return combines what it returns with the accumulator. The loop is
+// put in loop-simplify form afterwards for licm and ido.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_tre"
+STATISTIC(NumEliminated, "# of tail recursive calls turned into jumps");
+STATISTIC(NumAccumulators, "# of accumulators introduced");
+
+namespace{
+    // a call to the function itself and what it takes to return its result
+    struct tail_call{
+        CallInst *call;
+        BinaryOperator *accumulate;     // combines the result with one more value, or NULL
+    };
+
+    // shared by the legacy and the new pass manager passes
+    struct bso_tre_impl{
+        OptimizationRemarkEmitter &ORE;
+
+        bso_tre_impl(OptimizationRemarkEmitter &ORE) : ORE(ORE) {};
+
+        static bool isAccumulator(Instruction *I){
+            if (!I->getType()->isIntegerTy()) return false;
+            switch (I->getOpcode()){
+                case Instruction::Add:
+                case Instruction::Mul:
+                case Instruction::And:
+                case Instruction::Or:
+                case Instruction::Xor:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // the reused allocas must not be reachable from the recursive call
+        static bool hasUnsafeAllocas(Function &F){
+            for (Instruction &I : instructions(F)){
+                AllocaInst *AI = dyn_cast<AllocaInst>(&I);
+                if (AI == NULL) continue;
+                if (AI->getParent() != &F.getEntryBlock() or !AI->isStaticAlloca()) return true;
+                if (PointerMayBeCaptured(AI, true, true)) return true;
+            }
+            return false;
+        }
+
+        // what BB returns: the value of its ret, or of the phi of a return block it
+        // jumps to; false when BB neither returns nor jumps to a plain return block
+        static bool getReturned(BasicBlock *BB, Value *&returned){
+            TerminatorInst *T = BB->getTerminator();
+            if (ReturnInst *RI = dyn_cast<ReturnInst>(T)){
+                returned = RI->getReturnValue();
+                return true;
+            }
+            BranchInst *BI = dyn_cast<BranchInst>(T);
+            if (BI == NULL or BI->isConditional()) return false;
+            BasicBlock *R = BI->getSuccessor(0);
+            ReturnInst *RI = dyn_cast<ReturnInst>(R->getFirstNonPHIOrDbg());
+            if (RI == NULL) return false;
+            returned = RI->getReturnValue();
+            PHINode *PN = dyn_cast_or_null<PHINode>(returned);
+            if (PN != NULL and PN->getParent() == R){
+                returned = PN->getIncomingValueForBlock(BB);
+                // any other phi would need a value on the new edge too
+                return &R->front() == PN and PN->getNextNode() == R->getFirstNonPHI();
+            }
+            return !isa<PHINode>(R->front());
+        }
+
+        // CI and at most one accumulating operation are all that is left of BB
+        bool getTailCall(CallInst *CI, tail_call &tc){
+            Function &F = *CI->getFunction();
+            if (CI->getCalledFunction() != &F or CI->isMustTailCall()) return false;
+            tc = {CI, NULL};
+            for (Instruction *I = CI->getNextNode(); !I->isTerminator(); I = I->getNextNode()){
+                if (isa<DbgInfoIntrinsic>(I)) continue;
+                BinaryOperator *BO = dyn_cast<BinaryOperator>(I);
+                if (tc.accumulate != NULL or BO == NULL or !isAccumulator(BO)) return false;
+                if ((BO->getOperand(0) == CI) == (BO->getOperand(1) == CI)) return false;
+                tc.accumulate = BO;
+            }
+
+            Value *returned;
+            if (!getReturned(CI->getParent(), returned)) return false;
+            if (F.getReturnType()->isVoidTy()) return tc.accumulate == NULL;
+            Value *result = tc.accumulate != NULL ? (Value*)tc.accumulate : (Value*)CI;
+            if (returned != result or !result->hasOneUse()) return false;
+            return tc.accumulate == NULL or CI->hasOneUse();
+        }
+
+        std::vector<tail_call> findTailCalls(Function &F){
+            std::vector<tail_call> calls;
+            for (BasicBlock &BB : F){
+                for (Instruction &I : BB){
+                    CallInst *CI = dyn_cast<CallInst>(&I);
+                    tail_call tc;
+                    if (CI != NULL and getTailCall(CI, tc)) calls.push_back(tc);
+                }
+            }
+            // one accumulator: the calls that combine differently stay calls
+            unsigned opcode = 0;
+            std::vector<tail_call> kept;
+            for (tail_call &tc : calls){
+                if (tc.accumulate != NULL){
+                    if (opcode == 0) opcode = tc.accumulate->getOpcode();
+                    if (tc.accumulate->getOpcode() != opcode) continue;
+                }
+                kept.push_back(tc);
+            }
+            return kept;
+        }
+
+        // returns the loop header
+        BasicBlock *eliminate(Function &F, std::vector<tail_call> &calls){
+            // the allocas stay behind in the entry block, everything else loops
+            BasicBlock *entry = &F.getEntryBlock();
+            BasicBlock *header = entry->splitBasicBlock(entry->begin(), "tailrecurse");
+            for (auto it = header->begin(); it != header->end(); ){
+                Instruction *I = &*it++;
+                if (isa<AllocaInst>(I)) I->moveBefore(entry->getTerminator());
+            }
+
+            std::vector<PHINode*> args;
+            for (Argument &A : F.args()){
+                PHINode *PN = PHINode::Create(A.getType(), calls.size() + 1, A.getName() + ".tr",
+                                              header->getFirstNonPHI());
+                A.replaceAllUsesWith(PN);
+                PN->addIncoming(&A, entry);
+                args.push_back(PN);
+            }
+            unsigned opcode = 0;
+            for (tail_call &tc : calls){
+                if (tc.accumulate != NULL) opcode = tc.accumulate->getOpcode();
+            }
+            PHINode *acc = NULL;
+            if (opcode != 0){
+                acc = PHINode::Create(F.getReturnType(), calls.size() + 1, "accumulator.tr",
+                                      header->getFirstNonPHI());
+                acc->addIncoming(ConstantExpr::getBinOpIdentity(opcode, F.getReturnType()), entry);
+                ++NumAccumulators;
+            }
+
+            SmallPtrSet<BasicBlock*, 4> returns;
+            for (tail_call &tc : calls){
+                CallInst *CI = tc.call;
+                BasicBlock *BB = CI->getParent();
+                ORE.emit([&]{
+                    return OptimizationRemark(DEBUG_TYPE, "TailRecursion", CI)
+                        << "recursive call turned into a loop"
+                        << (tc.accumulate != NULL ? " with an accumulator" : "");
+                });
+                for (unsigned i = 0; i < args.size(); i++) args[i]->addIncoming(CI->getArgOperand(i), BB);
+                if (acc != NULL){
+                    Value *next = acc;
+                    if (tc.accumulate != NULL){
+                        BinaryOperator *BO = tc.accumulate;
+                        Value *other = BO->getOperand(BO->getOperand(0) == CI ? 1 : 0);
+                        next = BinaryOperator::Create((Instruction::BinaryOps)opcode, acc, other,
+                                                      "accumulate.tr", CI);
+                    }
+                    acc->addIncoming(next, BB);
+                }
+
+                TerminatorInst *T = BB->getTerminator();
+                // a phi left with one entry may be the result of a call erased below:
+                // keep it until the return block is known to be dead
+                if (BranchInst *BI = dyn_cast<BranchInst>(T)){
+                    BI->getSuccessor(0)->removePredecessor(BB, /*DontDeleteUselessPHIs=*/true);
+                    returns.insert(BI->getSuccessor(0));
+                }
+                BranchInst::Create(header, T);
+                T->eraseFromParent();
+                if (tc.accumulate != NULL) tc.accumulate->eraseFromParent();
+                CI->eraseFromParent();
+                ++NumEliminated;
+            }
+            for (BasicBlock *R : returns){
+                if (pred_empty(R)) DeleteDeadBlock(R);
+            }
+
+            // the base cases return what the calls they replace would have combined
+            if (acc == NULL) return header;
+            for (BasicBlock &BB : F){
+                ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator());
+                if (RI == NULL) continue;
+                Value *V = BinaryOperator::Create((Instruction::BinaryOps)opcode, acc,
+                                                  RI->getReturnValue(), "accumulate.ret", RI);
+                RI->setOperand(0, V);
+            }
+            return header;
+        }
+
+        bool runOnFunction(Function &F){
+            bso_phase_timer timer("bso_tre.eliminate", "BSO tail recursion elimination");
+            if (F.isVarArg() or F.callsFunctionThatReturnsTwice()) return false;
+            for (Argument &A : F.args()){
+                if (A.hasByValOrInAllocaAttr()) return false;
+            }
+            std::vector<tail_call> calls = findTailCalls(F);
+            if (calls.empty()) return false;
+            if (hasUnsafeAllocas(F)){
+                ORE.emit([&]{
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "EscapingAlloca", calls.front().call)
+                        << "recursive call left alone: the stack of the caller may be "
+                           "reachable from the callee";
+                });
+                return false;
+            }
+            LLVM_DEBUG(dbgs() << "bso_tre: " << calls.size() << " tail calls in "
+                              << F.getName() << "\n");
+            BasicBlock *header = eliminate(F, calls);
+
+            // a preheader, one latch and dedicated exits
+            DominatorTree DT(F);
+            LoopInfo LI(DT);
+            if (Loop *L = LI.getLoopFor(header)) simplifyLoop(L, &DT, &LI, NULL, NULL, false);
+            return true;
+        }
+    };
+
+    struct bso_tre : public FunctionPass{
+        static char ID;
+        bso_tre() : FunctionPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+        }
+
+        bool runOnFunction(Function &F) override{
+            bso_tre_impl impl(getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE());
+            return impl.runOnFunction(F);
+        }
+    };
+}
+
+PreservedAnalyses bso_tre_pass::run(Function &F, FunctionAnalysisManager &AM){
+    bso_tre_impl impl(AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+    if (!impl.runOnFunction(F)) return PreservedAnalyses::all();
+    return PreservedAnalyses::none();
+}
+
+char bso_tre::ID = 0;
+static RegisterPass<bso_tre> T("bso_tre", "BSO: Tail Recursion Elimination");
@@ -0,0 +1,715 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Analysis/LoopInfo.h" // analysis for loops
+#include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils.h"
+#include "passes.h"
+#include "phaseTimer.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+// vectorize innermost countable loops whose memory accesses are unit-stride
+// affine functions of the induction variable (the a*i+b families bso_ido works on).
+// The vector loop runs n - n%VF iterations and the original loop is kept as the
+// scalar epilogue for the rest.
+using namespace llvm;
+
+#define DEBUG_TYPE "bso_vectorize"
+STATISTIC(NumVectorized, "# of loops vectorized");
+
+static cl::opt<unsigned> ForceVF("bso-vectorize-width", cl::init(0), cl::Hidden,
+        cl::desc("BSO: force the vectorization factor, rounded down to a power of two "
+                 "(0 = use the cost model)"));
+
+namespace{
+    // shared by the legacy and the new pass manager passes
+    struct bso_vectorize_impl{
+        ScalarEvolution &SE;
+        AAResults &AA;
+        LoopInfo &LI;
+        TargetTransformInfo &TTI;
+        OptimizationRemarkEmitter &ORE;
+        DominatorTree *DT;      // kept up to date when given
+
+        bso_vectorize_impl(ScalarEvolution &SE, AAResults &AA, LoopInfo &LI,
+                           TargetTransformInfo &TTI, OptimizationRemarkEmitter &ORE,
+                           DominatorTree *DT)
+            : SE(SE), AA(AA), LI(LI), TTI(TTI), ORE(ORE), DT(DT) {};
+
+        // report why L stays scalar; returns false so bail-outs can return it
+        bool missed(Loop *L, StringRef name, StringRef reason){
+            ORE.emit([&]{
+                return OptimizationRemarkMissed(DEBUG_TYPE, name, L->getStartLoc(), L->getHeader())
+                    << "loop not vectorized: " << reason;
+            });
+            return false;
+        }
+
+        // a load or store inside the loop body
+        struct mem_access{
+            Instruction *I;
+            Value *ptr;
+            const SCEV *ptr_scev;
+            Type *elt_type;
+            bool is_store;
+            bool is_invariant;      // address does not change between iterations
+        };
+
+        // acc = phi [start, preheader], [op, latch] ; op = acc <opcode> x
+        struct reduction{
+            PHINode *phi;
+            BinaryOperator *op;
+            Value *start;
+        };
+
+        // state of the loop currently being widened
+        Loop *curr_loop;
+        unsigned vf;
+        BasicBlock *vec_ph;
+        std::map<Value*, Value*> scalar_map;    // in-loop value => its lane 0 copy
+        std::map<Value*, Value*> vector_map;    // in-loop value => its <vf x T> copy
+
+        // loops we already vectorized carry llvm.loop.isvectorized, so the scalar
+        // epilogue is not vectorized again on the next run
+        bool isVectorized(Loop *L){
+            MDNode *loop_id = L->getLoopID();
+            if (loop_id == NULL) return false;
+            for (unsigned i = 1; i < loop_id->getNumOperands(); i++){
+                MDNode *md = dyn_cast<MDNode>(loop_id->getOperand(i));
+                if (md == NULL or md->getNumOperands() == 0) continue;
+                MDString *name = dyn_cast<MDString>(md->getOperand(0));
+                if (name != NULL and name->getString() == "llvm.loop.isvectorized"){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void markVectorized(Loop *L){
+            LLVMContext &Ctx = L->getHeader()->getContext();
+            SmallVector<Metadata*, 4> mds;
+            mds.push_back(NULL);     // self reference, filled in below
+            if (MDNode *loop_id = L->getLoopID()){
+                for (unsigned i = 1; i < loop_id->getNumOperands(); i++){
+                    mds.push_back(loop_id->getOperand(i));
+                }
+            }
+            Metadata *flag[] = {MDString::get(Ctx, "llvm.loop.isvectorized"),
+                        ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx), 1))};
+            mds.push_back(MDNode::get(Ctx, flag));
+            MDNode *new_id = MDNode::get(Ctx, mds);
+            new_id->replaceOperandWith(0, new_id);
+            L->setLoopID(new_id);
+        }
+
+        // element types we know how to put in a vector register
+        bool isVectorizableType(Type *T, const DataLayout &DL){
+            if (!T->isIntegerTy() and !T->isFloatTy() and !T->isDoubleTy()) return false;
+            return DL.getTypeAllocSizeInBits(T) == T->getPrimitiveSizeInBits();
+        }
+
+        // identity element of the reduction operator, or NULL if op is not one we
+        // can reassociate
+        Constant* getIdentity(BinaryOperator *op){
+            Type *T = op->getType();
+            switch (op->getOpcode()){
+                case Instruction::Add:
+                case Instruction::Or:
+                case Instruction::Xor:
+                    return ConstantInt::get(T, 0);
+                case Instruction::Mul:
+                    return ConstantInt::get(T, 1);
+                case Instruction::And:
+                    return Constant::getAllOnesValue(T);
+                case Instruction::FAdd:
+                    return op->hasAllowReassoc() ? ConstantFP::getNegativeZero(T) : NULL;
+                case Instruction::FMul:
+                    return op->hasAllowReassoc() ? ConstantFP::get(T, 1.0) : NULL;
+                default:
+                    return NULL;
+            }
+        }
+
+        // address computations are re-done on lane 0 only, so they may only be
+        // built out of the induction variable, loop invariants and plain arithmetic
+        bool isUniformAddress(Value *V, PHINode *iv){
+            Instruction *I = dyn_cast<Instruction>(V);
+            if (I == NULL or !curr_loop->contains(I) or I == iv) return true;
+            if (!isa<GetElementPtrInst>(I) and !isa<CastInst>(I) and !isa<BinaryOperator>(I)){
+                return false;
+            }
+            for (unsigned i = 0; i < I->getNumOperands(); i++){
+                if (!isUniformAddress(I->getOperand(i), iv)) return false;
+            }
+            return true;
+        }
+
+        // dependence test on the affine subscripts. Returns the largest VF the
+        // accesses allow (~0u if unbounded) or 0 if the loop cannot be vectorized.
+        unsigned getMaxSafeVF(std::vector<mem_access> &accesses, ScalarEvolution &SE,
+                              AAResults &AA, const DataLayout &DL){
+            unsigned max_vf = ~0u;
+            for (unsigned i = 0; i < accesses.size(); i++){
+                for (unsigned j = i + 1; j < accesses.size(); j++){
+                    mem_access &a = accesses[i];    // a comes before b in the body
+                    mem_access &b = accesses[j];
+                    if (!a.is_store and !b.is_store) continue;
+
+                    const SCEV *base_a = SE.getPointerBase(a.ptr_scev);
+                    const SCEV *base_b = SE.getPointerBase(b.ptr_scev);
+                    if (a.is_invariant or b.is_invariant or base_a != base_b){
+                        // different arrays: fine as long as they cannot overlap
+                        const SCEVUnknown *u_a = dyn_cast<SCEVUnknown>(base_a);
+                        const SCEVUnknown *u_b = dyn_cast<SCEVUnknown>(base_b);
+                        if (u_a == NULL or u_b == NULL or u_a == u_b or
+                            !AA.isNoAlias(u_a->getValue(), u_b->getValue())){
+                            return 0;
+                        }
+                        continue;
+                    }
+
+                    // same array: a[i+x] against a[i+y], distance x-y in elements
+                    uint64_t size = DL.getTypeAllocSize(a.elt_type);
+                    if (size != DL.getTypeAllocSize(b.elt_type)) return 0;
+                    const SCEVConstant *dist =
+                        dyn_cast<SCEVConstant>(SE.getMinusSCEV(a.ptr_scev, b.ptr_scev));
+                    if (dist == NULL) return 0;
+                    int64_t bytes = dist->getAPInt().getSExtValue();
+                    if (bytes % (int64_t)size != 0) return 0;
+                    int64_t d = bytes / (int64_t)size;
+
+                    // element k is touched by a in iteration k-x and by b in iteration
+                    // k-y, so the access with the larger offset gets there first. If that
+                    // is a, the vector body keeps the scalar order for any VF.
+                    if (d >= 0) continue;
+                    // otherwise both must never land in the same vector iteration
+                    if ((uint64_t)(-d) < max_vf) max_vf = (unsigned)(-d);
+                }
+            }
+            return max_vf;
+        }
+
+        // vector register width of the build host, used when the module is compiled
+        // for the machine we are running on
+        unsigned getHostVectorBits(){
+            StringMap<bool> features;
+            if (!sys::getHostCPUFeatures(features)) return 0;
+            if (features.lookup("avx2")) return 256;
+            if (features.lookup("sse2")) return 128;
+            return 0;
+        }
+
+        // cost model: fill one vector register with the widest element in the loop;
+        // a power of two, the reduction halves the vector down to one lane
+        unsigned chooseVF(Function &F, unsigned widest_bits){
+            if (ForceVF != 0) return PowerOf2Floor(ForceVF);
+            unsigned reg_bits = TTI.getRegisterBitWidth(true);
+            Triple target(F.getParent()->getTargetTriple());
+            Triple host(sys::getProcessTriple());
+            if (target.getArch() == Triple::UnknownArch or target.getArch() == host.getArch()){
+                unsigned host_bits = getHostVectorBits();
+                if (host_bits > reg_bits) reg_bits = host_bits;
+            }
+            return PowerOf2Floor(reg_bits / widest_bits);
+        }
+
+        // what the scalar access guarantees; left as 0 on the wide access it would
+        // claim the alignment of the whole vector
+        template <typename AccessT>
+        unsigned getAlignment(AccessT *I, Type *T, const DataLayout &DL){
+            unsigned align = I->getAlignment();
+            return align != 0 ? align : DL.getABITypeAlignment(T);
+        }
+
+        // lane 0 copy of an in-loop value, used for addresses
+        Value* getScalar(Value *V, IRBuilder<> &B){
+            Instruction *I = dyn_cast<Instruction>(V);
+            if (I == NULL or !curr_loop->contains(I)) return V;
+            if (scalar_map.find(V) != scalar_map.end()) return scalar_map[V];
+            Instruction *copy = I->clone();
+            for (unsigned i = 0; i < I->getNumOperands(); i++){
+                copy->setOperand(i, getScalar(I->getOperand(i), B));
+            }
+            B.Insert(copy, I->getName() + ".bso_vec");
+            scalar_map[V] = copy;
+            return copy;
+        }
+
+        // <vf x T> copy of a value; loop invariants are splatted in the preheader
+        Value* getVector(Value *V){
+            if (vector_map.find(V) != vector_map.end()) return vector_map[V];
+            IRBuilder<> PB(vec_ph->getTerminator());
+            Value *splat = PB.CreateVectorSplat(vf, V, "bso_vec.splat");
+            vector_map[V] = splat;
+            return splat;
+        }
+
+        // log2(vf) shuffle steps folding a vector down to lane 0
+        Value* reduceVector(Value *vec, BinaryOperator *op, IRBuilder<> &B){
+            for (unsigned w = vf / 2; w >= 1; w /= 2){
+                SmallVector<Constant*, 16> mask;
+                for (unsigned i = 0; i < vf; i++){
+                    if (i < w){
+                        mask.push_back(B.getInt32(i + w));
+                    }else{
+                        mask.push_back(UndefValue::get(B.getInt32Ty()));
+                    }
+                }
+                Value *shuf = B.CreateShuffleVector(vec, UndefValue::get(vec->getType()),
+                                                    ConstantVector::get(mask), "bso_vec.rdx.shuf");
+                vec = B.CreateBinOp(op->getOpcode(), vec, shuf, "bso_vec.rdx");
+                if (Instruction *rdx = dyn_cast<Instruction>(vec)) rdx->copyIRFlags(op);
+            }
+            return B.CreateExtractElement(vec, B.getInt32(0), "bso_vec.rdx.res");
+        }
+
+        bool runOnLoop(Loop * L){
+            BasicBlock *header, *preheader, *exit;
+            Function *F;
+            PHINode *induction_var = NULL;
+            std::vector<reduction> reductions;
+            std::vector<mem_access> accesses;
+            std::set<Instruction*> vector_needed;
+            std::vector<Instruction*> worklist;
+            unsigned widest_bits = 0;
+
+            curr_loop = L;
+            scalar_map.clear();
+            vector_map.clear();
+
+            bso_phase_timer timer("bso_vectorize.loop", "BSO vectorize: legality, cost and widening");
+            // only innermost single block loops with one exit
+            if (isVectorized(L)) return false;
+            if (!L->getSubLoops().empty() or L->getNumBlocks() != 1){
+                return missed(L, "NotSingleBlock", "only innermost single block loops are handled");
+            }
+            header = L->getHeader();
+            preheader = L->getLoopPreheader();
+            exit = L->getExitBlock();
+            if (preheader == NULL or exit == NULL or exit->getSinglePredecessor() != header){
+                return missed(L, "NotSimplified", "loop needs a preheader and a dedicated single exit");
+            }
+            BranchInst *latch_br = dyn_cast<BranchInst>(header->getTerminator());
+            if (latch_br == NULL or !latch_br->isConditional()){
+                return missed(L, "NotSimplified", "loop does not end in a conditional branch");
+            }
+
+            F = header->getParent();
+            const DataLayout &DL = F->getParent()->getDataLayout();
+
+            // the loop must be countable
+            const SCEV *backedge_count = SE.getBackedgeTakenCount(L);
+            if (isa<SCEVCouldNotCompute>(backedge_count)){
+                return missed(L, "UncountableLoop", "the trip count cannot be computed");
+            }
+
+            // classify the phis: one unit-stride induction variable, the rest reductions
+            for (Instruction &I : *header){
+                PHINode *phi = dyn_cast<PHINode>(&I);
+                if (phi == NULL) break;
+                PHINode &PN = *phi;
+                const SCEVAddRecExpr *SARE = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+                if (SARE != NULL and SARE->getLoop() == L and SARE->isAffine() and
+                    PN.getType()->isIntegerTy() and induction_var == NULL){
+                    const SCEVConstant *step = dyn_cast<SCEVConstant>(SARE->getStepRecurrence(SE));
+                    if (step != NULL and step->getValue()->isOne()){
+                        induction_var = &PN;
+                        continue;
+                    }
+                }
+                BinaryOperator *op = dyn_cast<BinaryOperator>(PN.getIncomingValueForBlock(header));
+                if (op == NULL or !PN.hasOneUse() or *PN.user_begin() != op or
+                    (op->getOperand(0) != &PN and op->getOperand(1) != &PN) or
+                    !isVectorizableType(PN.getType(), DL) or getIdentity(op) == NULL){
+                    return missed(L, "UnsupportedPhi", "a phi is neither the induction variable "
+                                  "nor a supported reduction");
+                }
+                for (User *U : op->users()){
+                    Instruction *UI = cast<Instruction>(U);
+                    if (UI != &PN and L->contains(UI)){
+                        return missed(L, "UnsupportedPhi", "a reduction value is used inside the loop");
+                    }
+                }
+                reduction r;
+                r.phi = &PN;
+                r.op = op;
+                r.start = PN.getIncomingValueForBlock(preheader);
+                reductions.push_back(r);
+            }
+            if (induction_var == NULL){
+                return missed(L, "NoInductionVariable", "no integer induction variable with step one");
+            }
+
+            // every instruction must be something we know how to widen, and every
+            // memory access must be unit-stride or invariant
+            for (Instruction &I : *header){
+                // values leaving the loop must be reductions, seen through the LCSSA phis
+                for (User *U : I.users()){
+                    Instruction *UI = cast<Instruction>(U);
+                    if (L->contains(UI)) continue;
+                    bool is_reduction = false;
+                    for (auto &r : reductions){
+                        if (r.op == &I) is_reduction = true;
+                    }
+                    if (!isa<PHINode>(UI) or UI->getParent() != exit or !is_reduction){
+                        return missed(L, "LiveOut", "a value other than a reduction is used after the loop");
+                    }
+                }
+                if (isa<PHINode>(I) or isa<DbgInfoIntrinsic>(I) or &I == latch_br) continue;
+                if (!isa<BinaryOperator>(I) and !isa<CastInst>(I) and !isa<CmpInst>(I) and
+                    !isa<SelectInst>(I) and !isa<GetElementPtrInst>(I) and
+                    !isa<LoadInst>(I) and !isa<StoreInst>(I)){
+                    return missed(L, "UnsupportedInstruction", "the loop contains an instruction "
+                                  "that cannot be widened");
+                }
+                if (isa<LoadInst>(I) or isa<StoreInst>(I)){
+                    mem_access a;
+                    a.I = &I;
+                    a.is_store = isa<StoreInst>(I);
+                    if (a.is_store){
+                        StoreInst *SI = cast<StoreInst>(&I);
+                        if (!SI->isSimple()){
+                            return missed(L, "VolatileOrAtomic", "the loop has a volatile or atomic store");
+                        }
+                        a.ptr = SI->getPointerOperand();
+                        a.elt_type = SI->getValueOperand()->getType();
+                        worklist.push_back(&I);
+                    }else{
+                        LoadInst *LdI = cast<LoadInst>(&I);
+                        if (!LdI->isSimple()){
+                            return missed(L, "VolatileOrAtomic", "the loop has a volatile or atomic load");
+                        }
+                        a.ptr = LdI->getPointerOperand();
+                        a.elt_type = LdI->getType();
+                    }
+                    if (!isVectorizableType(a.elt_type, DL)){
+                        return missed(L, "UnsupportedType", "a memory access has no vector type");
+                    }
+                    a.ptr_scev = SE.getSCEV(a.ptr);
+                    a.is_invariant = SE.isLoopInvariant(a.ptr_scev, L);
+                    if (a.is_invariant){
+                        // a store to the same address every iteration is a loop carried dependence
+                        if (a.is_store){
+                            return missed(L, "InvariantStore", "the loop stores to the same address "
+                                          "every iteration");
+                        }
+                    }else{
+                        const SCEVAddRecExpr *SARE = dyn_cast<SCEVAddRecExpr>(a.ptr_scev);
+                        const SCEVConstant *step = NULL;
+                        if (SARE != NULL and SARE->getLoop() == L and SARE->isAffine()){
+                            step = dyn_cast<SCEVConstant>(SARE->getStepRecurrence(SE));
+                        }
+                        if (step == NULL or
+                            step->getAPInt().getSExtValue() != (int64_t)DL.getTypeAllocSize(a.elt_type)){
+                            return missed(L, "NonUnitStride", "a memory access is not unit stride");
+                        }
+                        if (!isUniformAddress(a.ptr, induction_var)){
+                            return missed(L, "NonUnitStride", "an address depends on the loop "
+                                          "through more than the induction variable");
+                        }
+                    }
+                    unsigned bits = a.elt_type->getPrimitiveSizeInBits();
+                    if (bits > widest_bits) widest_bits = bits;
+                    accesses.push_back(a);
+                }
+            }
+            for (auto &r : reductions){
+                worklist.push_back(r.op);
+                unsigned bits = r.phi->getType()->getPrimitiveSizeInBits();
+                if (bits > widest_bits) widest_bits = bits;
+            }
+            if ((accesses.empty() and reductions.empty()) or widest_bits == 0){
+                return missed(L, "NothingToVectorize", "the loop has no memory accesses or reductions");
+            }
+
+            // everything the stored values and the reductions depend on is widened
+            while (!worklist.empty()){
+                Instruction *I = worklist.back();
+                worklist.pop_back();
+                unsigned first = 0;
+                if (StoreInst *SI = dyn_cast<StoreInst>(I)){
+                    // only the stored value, the address stays scalar
+                    first = SI->getNumOperands();
+                    Instruction *val = dyn_cast<Instruction>(SI->getValueOperand());
+                    if (val != NULL and L->contains(val) and vector_needed.insert(val).second){
+                        worklist.push_back(val);
+                    }
+                }
+                if (isa<LoadInst>(I) or isa<PHINode>(I)) continue;
+                if (!isa<StoreInst>(I)) vector_needed.insert(I);
+                for (unsigned i = first; i < I->getNumOperands(); i++){
+                    Instruction *opnd = dyn_cast<Instruction>(I->getOperand(i));
+                    if (opnd == NULL or !L->contains(opnd)) continue;
+                    if (isa<GetElementPtrInst>(opnd)){
+                        return missed(L, "UnsupportedAddress", "a computed address is used as a value");
+                    }
+                    if (vector_needed.insert(opnd).second) worklist.push_back(opnd);
+                }
+            }
+            for (Instruction *I : vector_needed){
+                if (!I->getType()->isIntegerTy() and !I->getType()->isFloatingPointTy()){
+                    return missed(L, "UnsupportedType", "a widened value has no vector type");
+                }
+                unsigned bits = I->getType()->getScalarSizeInBits();
+                if (bits > widest_bits) widest_bits = bits;
+            }
+
+            // pick VF from the cost model, then shrink it to what the dependences allow
+            unsigned max_safe_vf = getMaxSafeVF(accesses, SE, AA, DL);
+            vf = chooseVF(*F, widest_bits);
+            while (vf > max_safe_vf) vf /= 2;
+            if (vf < 2){
+                if (max_safe_vf < 2){
+                    return missed(L, "MemoryDependence", "a loop carried memory dependence "
+                                  "prevents vectorization");
+                }
+                return missed(L, "CostModel", "the target has no profitable vector width");
+            }
+            unsigned const_trip = SE.getSmallConstantTripCount(L);
+            if (const_trip != 0 and const_trip < vf){
+                return missed(L, "ShortTripCount", "the loop runs fewer iterations than the "
+                              "vectorization factor");
+            }
+
+            // ---- legal and profitable, build the vector loop ----
+            Type *iv_type = induction_var->getType();
+            LLVMContext &Ctx = F->getContext();
+            Value *iv_start = induction_var->getIncomingValueForBlock(preheader);
+            const SCEV *trip_count = SE.getAddExpr(backedge_count, SE.getOne(backedge_count->getType()));
+            trip_count = SE.getTruncateOrZeroExtend(trip_count, iv_type);
+            SCEVExpander expander(SE, DL, "bso_vec");
+            Value *tc = expander.expandCodeFor(trip_count, iv_type, preheader->getTerminator());
+            SE.forgetLoop(L);
+
+            // preheader -> (vector body -> middle) -> scalar preheader -> original loop
+            BasicBlock *scalar_ph = preheader->splitBasicBlock(preheader->getTerminator(),
+                                                               "bso_vec.scalar.ph");
+            BasicBlock *vec_body = BasicBlock::Create(Ctx, "bso_vec.body", F, scalar_ph);
+            BasicBlock *middle = BasicBlock::Create(Ctx, "bso_vec.middle", F, scalar_ph);
+            vec_ph = preheader;
+
+            IRBuilder<> PB(preheader->getTerminator());
+            Value *n_vec = PB.CreateSub(tc, PB.CreateURem(tc, ConstantInt::get(iv_type, vf)), "bso_vec.n");
+            Value *skip_vec = PB.CreateICmpEQ(n_vec, ConstantInt::get(iv_type, 0), "bso_vec.skip");
+            PB.CreateCondBr(skip_vec, scalar_ph, vec_body);
+            preheader->getTerminator()->eraseFromParent();
+
+            IRBuilder<> B(vec_body);
+            PHINode *index = B.CreatePHI(iv_type, 2, "bso_vec.index");
+            std::vector<PHINode*> vec_phis;
+            for (auto &r : reductions){
+                Type *vec_type = VectorType::get(r.phi->getType(), vf);
+                Value *init = ConstantVector::getSplat(vf, getIdentity(r.op));
+                init = IRBuilder<>(preheader->getTerminator()).CreateInsertElement(init, r.start,
+                                                                   B.getInt32(0), "bso_vec.rdx.init");
+                PHINode *vec_phi = B.CreatePHI(vec_type, 2, r.phi->getName() + ".bso_vec");
+                vec_phi->addIncoming(init, preheader);
+                vector_map[r.phi] = vec_phi;
+                vec_phis.push_back(vec_phi);
+            }
+
+            // induction variable: scalar on lane 0, <i, i+1, ..., i+vf-1> for data uses
+            Value *iv_lane0 = B.CreateAdd(iv_start, index, induction_var->getName() + ".bso_vec");
+            scalar_map[induction_var] = iv_lane0;
+            SmallVector<Constant*, 16> steps;
+            for (unsigned i = 0; i < vf; i++){
+                steps.push_back(ConstantInt::get(iv_type, i));
+            }
+            vector_map[induction_var] = B.CreateAdd(B.CreateVectorSplat(vf, iv_lane0),
+                                    ConstantVector::get(steps), "bso_vec.ind");
+
+            // widen the body in program order, so memory accesses keep their order
+            for (Instruction &I : *header){
+                if (isa<PHINode>(I) or I.isTerminator()) continue;
+                if (LoadInst *LdI = dyn_cast<LoadInst>(&I)){
+                    if (vector_needed.find(&I) == vector_needed.end()) continue;
+                    Value *ptr = getScalar(LdI->getPointerOperand(), B);
+                    if (SE.isLoopInvariant(SE.getSCEV(LdI->getPointerOperand()), L)){
+                        LoadInst *scalar = B.CreateLoad(ptr, I.getName() + ".bso_vec");
+                        scalar->setAlignment(getAlignment(LdI, I.getType(), DL));
+                        vector_map[&I] = B.CreateVectorSplat(vf, scalar);
+                    }else{
+                        Type *vec_type = VectorType::get(I.getType(), vf);
+                        Value *vec_ptr = B.CreateBitCast(ptr,
+                                PointerType::get(vec_type, LdI->getPointerAddressSpace()));
+                        LoadInst *wide = B.CreateLoad(vec_ptr, I.getName() + ".bso_vec");
+                        wide->setAlignment(getAlignment(LdI, I.getType(), DL));
+                        vector_map[&I] = wide;
+                    }
+                }else if (StoreInst *SI = dyn_cast<StoreInst>(&I)){
+                    Value *val = getVector(SI->getValueOperand());
+                    Value *ptr = getScalar(SI->getPointerOperand(), B);
+                    Value *vec_ptr = B.CreateBitCast(ptr,
+                            PointerType::get(val->getType(), SI->getPointerAddressSpace()));
+                    StoreInst *wide = B.CreateStore(val, vec_ptr);
+                    wide->setAlignment(getAlignment(SI, SI->getValueOperand()->getType(), DL));
+                }else if (vector_needed.find(&I) != vector_needed.end()){
+                    Value *wide;
+                    if (auto *BO = dyn_cast<BinaryOperator>(&I)){
+                        wide = B.CreateBinOp(BO->getOpcode(), getVector(BO->getOperand(0)),
+                                        getVector(BO->getOperand(1)), I.getName() + ".bso_vec");
+                    }else if (auto *CI = dyn_cast<CastInst>(&I)){
+                        wide = B.CreateCast(CI->getOpcode(), getVector(CI->getOperand(0)),
+                                        VectorType::get(I.getType(), vf), I.getName() + ".bso_vec");
+                    }else if (auto *Cmp = dyn_cast<ICmpInst>(&I)){
+                        wide = B.CreateICmp(Cmp->getPredicate(), getVector(Cmp->getOperand(0)),
+                                        getVector(Cmp->getOperand(1)), I.getName() + ".bso_vec");
+                    }else if (auto *Cmp = dyn_cast<FCmpInst>(&I)){
+                        wide = B.CreateFCmp(Cmp->getPredicate(), getVector(Cmp->getOperand(0)),
+                                        getVector(Cmp->getOperand(1)), I.getName() + ".bso_vec");
+                    }else{
+                        auto *Sel = cast<SelectInst>(&I);
+                        wide = B.CreateSelect(getVector(Sel->getCondition()),
+                                        getVector(Sel->getTrueValue()),
+                                        getVector(Sel->getFalseValue()), I.getName() + ".bso_vec");
+                    }
+                    if (Instruction *WI = dyn_cast<Instruction>(wide)) WI->copyIRFlags(&I);
+                    vector_map[&I] = wide;
+                }
+            }
+
+            // vector latch
+            Value *next_index = B.CreateAdd(index, ConstantInt::get(iv_type, vf), "bso_vec.index.next");
+            B.CreateCondBr(B.CreateICmpEQ(next_index, n_vec), middle, vec_body);
+            index->addIncoming(ConstantInt::get(iv_type, 0), preheader);
+            index->addIncoming(next_index, vec_body);
+            for (unsigned i = 0; i < reductions.size(); i++){
+                vec_phis[i]->addIncoming(vector_map[reductions[i].op], vec_body);
+            }
+
+            // middle block: finish the reductions and skip the epilogue if nothing is left
+            IRBuilder<> MB(middle);
+            std::vector<Value*> reduced;
+            for (unsigned i = 0; i < reductions.size(); i++){
+                reduced.push_back(reduceVector(vector_map[reductions[i].op], reductions[i].op, MB));
+            }
+            Value *iv_resume = MB.CreateAdd(iv_start, n_vec, "bso_vec.ind.end");
+            MB.CreateCondBr(MB.CreateICmpEQ(n_vec, tc, "bso_vec.done"), exit, scalar_ph);
+
+            // scalar epilogue resumes where the vector loop stopped
+            IRBuilder<> SB(scalar_ph, scalar_ph->begin());
+            PHINode *iv_phi = SB.CreatePHI(iv_type, 2, "bso_vec.resume");
+            iv_phi->addIncoming(iv_start, preheader);
+            iv_phi->addIncoming(iv_resume, middle);
+            induction_var->setIncomingValue(induction_var->getBasicBlockIndex(scalar_ph), iv_phi);
+            for (unsigned i = 0; i < reductions.size(); i++){
+                PHINode *rdx_phi = SB.CreatePHI(reductions[i].phi->getType(), 2, "bso_vec.rdx.resume");
+                rdx_phi->addIncoming(reductions[i].start, preheader);
+                rdx_phi->addIncoming(reduced[i], middle);
+                reductions[i].phi->setIncomingValue(
+                        reductions[i].phi->getBasicBlockIndex(scalar_ph), rdx_phi);
+            }
+            for (Instruction &I : *exit){
+                PHINode *PN = dyn_cast<PHINode>(&I);
+                if (PN == NULL) break;
+                Value *V = PN->getIncomingValueForBlock(header);
+                for (unsigned i = 0; i < reductions.size(); i++){
+                    if (V == reductions[i].op) V = reduced[i];
+                }
+                PN->addIncoming(V, middle);
+            }
+
+            // keep LoopInfo and the dominator tree in sync for the passes after us
+            Loop *vec_loop = LI.AllocateLoop();
+            if (Loop *parent = L->getParentLoop()){
+                parent->addChildLoop(vec_loop);
+                parent->addBasicBlockToLoop(middle, LI);
+                parent->addBasicBlockToLoop(scalar_ph, LI);
+            }else{
+                LI.addTopLevelLoop(vec_loop);
+            }
+            vec_loop->addBasicBlockToLoop(vec_body, LI);
+            if (DT != NULL) DT->recalculate(*F);
+            // the scalar loop now starts where the vector loop stopped
+            SE.forgetLoop(L);
+            markVectorized(L);
+            markVectorized(vec_loop);
+
+            ORE.emit([&]{
+                return OptimizationRemark(DEBUG_TYPE, "Vectorized", L->getStartLoc(), header)
+                    << "vectorized loop (vectorization factor: " << ore::NV("VF", vf)
+                    << ", reductions: " << ore::NV("Reductions", (unsigned)reductions.size()) << ")";
+            });
+            ++NumVectorized;
+            return true;
+        }
+    };
+
+    struct bso_vectorize : public LoopPass{
+        static char ID;
+        bso_vectorize() : LoopPass(ID) {};
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override{
+            AU.addRequiredID(LoopSimplifyID);
+            AU.addRequiredID(LCSSAID);
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<ScalarEvolutionWrapperPass>();
+            AU.addRequired<AAResultsWrapperPass>();
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+        }
+
+        bool runOnLoop(Loop * L, LPPassManager &LPM) override{
+            Function &F = *L->getHeader()->getParent();
+            DominatorTree *DT = NULL;
+            if (auto *DTWP = getAnalysisIfAvailable<DominatorTreeWrapperPass>()){
+                DT = &DTWP->getDomTree();
+            }
+            OptimizationRemarkEmitter ORE(&F);
+            bso_vectorize_impl impl(getAnalysis<ScalarEvolutionWrapperPass>().getSE(),
+                                    getAnalysis<AAResultsWrapperPass>().getAAResults(),
+                                    getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                                    getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F), ORE, DT);
+            return impl.runOnLoop(L);
+        }
+    };
+}
+
+PreservedAnalyses bso_vectorize_pass::run(Function &F, FunctionAnalysisManager &AM){
+    LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+    bso_vectorize_impl impl(AM.getResult<ScalarEvolutionAnalysis>(F), AM.getResult<AAManager>(F),
+                            LI, AM.getResult<TargetIRAnalysis>(F),
+                            AM.getResult<OptimizationRemarkEmitterAnalysis>(F),
+                            &AM.getResult<DominatorTreeAnalysis>(F));
+    bool isChanged = false;
+
+    // the vector loops we add are innermost too, collect the work list first
+    std::vector<Loop*> innermost;
+    for (Loop *L : LI.getLoopsInPreorder()){
+        if (L->getSubLoops().empty()) innermost.push_back(L);
+    }
+    for (Loop *L : innermost){
+        isChanged |= impl.runOnLoop(L);
+    }
+    if (!isChanged) return PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    PA.preserve<LoopAnalysis>();
+    PA.preserve<DominatorTreeAnalysis>();
+    PA.preserve<ScalarEvolutionAnalysis>();
+    return PA;
+}
+
+std::string bso_vectorize_pass::options(){
+    return "bso-vectorize-width=" + std::to_string(ForceVF);
+}
+
+char bso_vectorize::ID = 0;
+static RegisterPass<bso_vectorize> V("bso_vectorize", "BSO: Loop Vectorization");